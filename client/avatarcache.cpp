@@ -0,0 +1,119 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "avatarcache.h"
+
+#include <QtCore/QSettings>
+#include <QtCore/QDebug>
+#include <QtGui/QGuiApplication>
+
+#include "lib/user.h"
+
+uint qHash(const AvatarCache::Key& key, uint seed)
+{
+    return qHash(key.user, seed) ^ qHash(key.size.width() << 16 | key.size.height(), seed)
+            ^ qHash(qRound(key.dpr * 100), seed);
+}
+
+AvatarCache* AvatarCache::instance()
+{
+    static AvatarCache* cache = new AvatarCache(qApp);
+    return cache;
+}
+
+AvatarCache::AvatarCache(QObject* parent)
+    : QObject(parent)
+    , m_hits(0)
+    , m_misses(0)
+{
+    // QCache counts cost in arbitrary units; we use bytes
+    setCapacityBytes(QSettings().value("UI/avatar_cache_kb", 8192).toInt() * 1024);
+}
+
+QPixmap AvatarCache::avatar(QMatrixClient::User* user, int width, int height)
+{
+    return avatar(user, QSize(width, height), qApp->devicePixelRatio());
+}
+
+QPixmap AvatarCache::avatar(QMatrixClient::User* user, QSize size, qreal dpr)
+{
+    if (!user)
+        return QPixmap();
+
+    Key key { user, size, dpr };
+    if (QPixmap* cached = m_pixmaps.object(key))
+    {
+        ++m_hits;
+        return *cached;
+    }
+    ++m_misses;
+
+    QSize deviceSize = size * dpr;
+    QPixmap pixmap = user->avatar(deviceSize.width(), deviceSize.height());
+    // The avatar may not have arrived yet; don't cache a placeholder that
+    // nobody would invalidate.
+    if (pixmap.isNull())
+        return pixmap;
+    pixmap.setDevicePixelRatio(dpr);
+
+    if (!m_userKeys.contains(user))
+        connect( user, &QMatrixClient::User::avatarChanged,
+                 this, &AvatarCache::avatarChanged, Qt::UniqueConnection );
+    m_userKeys.insert(user, key);
+    int cost = pixmap.width() * pixmap.height() * pixmap.depth() / 8;
+    m_pixmaps.insert(key, new QPixmap(pixmap), cost);
+    return pixmap;
+}
+
+void AvatarCache::avatarChanged(QMatrixClient::User* user)
+{
+    for (const Key& key: m_userKeys.values(user))
+        m_pixmaps.remove(key);
+    m_userKeys.remove(user);
+}
+
+void AvatarCache::clear()
+{
+    for (auto user: m_userKeys.uniqueKeys())
+        user->disconnect(this);
+    m_pixmaps.clear();
+    m_userKeys.clear();
+}
+
+int AvatarCache::usedBytes() const
+{
+    return m_pixmaps.totalCost();
+}
+
+int AvatarCache::capacityBytes() const
+{
+    return m_pixmaps.maxCost();
+}
+
+void AvatarCache::setCapacityBytes(int bytes)
+{
+    m_pixmaps.setMaxCost(bytes);
+}
+
+void AvatarCache::report() const
+{
+    qDebug() << "Avatar cache:" << m_pixmaps.count() << "pixmap(s),"
+             << usedBytes() / 1024 << "of" << capacityBytes() / 1024 << "KiB used,"
+             << m_hits << "hit(s)," << m_misses << "miss(es)";
+}
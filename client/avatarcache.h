@@ -0,0 +1,85 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef AVATARCACHE_H
+#define AVATARCACHE_H
+
+#include <QtCore/QObject>
+#include <QtCore/QCache>
+#include <QtCore/QMultiHash>
+#include <QtCore/QSize>
+#include <QtGui/QPixmap>
+
+namespace QMatrixClient
+{
+    class User;
+}
+
+/**
+ * A process-wide cache of scaled user avatars.
+ *
+ * Pixmaps are keyed by the user, the logical size and the device pixel
+ * ratio they are requested for, so every view asking for the same avatar
+ * at the same size shares a single pixmap. Entries of a user are dropped
+ * as soon as the user's avatar changes. The total size of cached pixmaps
+ * is bounded by the "UI/avatar_cache_kb" setting.
+ */
+class AvatarCache: public QObject
+{
+        Q_OBJECT
+    public:
+        static AvatarCache* instance();
+
+        QPixmap avatar(QMatrixClient::User* user, QSize size, qreal dpr);
+        QPixmap avatar(QMatrixClient::User* user, int width, int height);
+
+        void clear();
+
+        int usedBytes() const;
+        int capacityBytes() const;
+        void setCapacityBytes(int bytes);
+        void report() const;
+
+    private slots:
+        void avatarChanged(QMatrixClient::User* user);
+
+    private:
+        struct Key
+        {
+            QMatrixClient::User* user;
+            QSize size;
+            qreal dpr;
+
+            bool operator==(const Key& other) const
+            {
+                return user == other.user && size == other.size &&
+                        dpr == other.dpr;
+            }
+        };
+        friend uint qHash(const Key& key, uint seed);
+
+        explicit AvatarCache(QObject* parent = nullptr);
+
+        QCache<Key, QPixmap> m_pixmaps;
+        QMultiHash<QMatrixClient::User*, Key> m_userKeys;
+        int m_hits;
+        int m_misses;
+};
+
+#endif // AVATARCACHE_H
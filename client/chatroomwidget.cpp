@@ -21,6 +21,14 @@
 
 #include <QtCore/QDebug>
 #include <QtCore/QTimer>
+#include <QtCore/QDir>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QMimeData>
+#include <QtGui/QImageReader>
+#include <QtGui/QClipboard>
+#include <QtGui/QDragEnterEvent>
+#include <QtGui/QDropEvent>
+#include <QtWidgets/QApplication>
 #include <QtWidgets/QListView>
 #include <QtWidgets/QLineEdit>
 #include <QtWidgets/QVBoxLayout>
@@ -38,9 +46,17 @@
 #include "lib/jobs/postmessagejob.h"
 #include "lib/events/event.h"
 #include "lib/events/typingevent.h"
+#include "lib/events/roommessageevent.h"
 #include "models/messageeventmodel.h"
+#include "message.h"
 #include "quaternionroom.h"
+#include "quaternionconnection.h"
 #include "imageprovider.h"
+#include "downloadmanager.h"
+#include "uploadmanager.h"
+#include "outgoingqueue.h"
+#include "imageviewer.h"
+#include "completionindex.h"
 
 class ChatEdit : public QLineEdit
 {
@@ -48,6 +64,8 @@ class ChatEdit : public QLineEdit
         ChatEdit(ChatRoomWidget* c);
     protected:
         bool event(QEvent *event);
+        void dragEnterEvent(QDragEnterEvent* event);
+        void dropEvent(QDropEvent* event);
     private:
         ChatRoomWidget* m_chatRoomWidget;
 };
@@ -63,16 +81,38 @@ bool ChatEdit::event(QEvent *event)
             return true;
         } else
             m_chatRoomWidget->cancelCompletion();
+        if (keyEvent->matches(QKeySequence::Paste) &&
+                m_chatRoomWidget->sendImages(QApplication::clipboard()->mimeData()))
+            return true;
     }
     return QLineEdit::event(event);
 }
 
+void ChatEdit::dragEnterEvent(QDragEnterEvent* event)
+{
+    if (event->mimeData()->hasImage() || event->mimeData()->hasUrls())
+        event->acceptProposedAction();
+    else
+        QLineEdit::dragEnterEvent(event);
+}
+
+void ChatEdit::dropEvent(QDropEvent* event)
+{
+    if (m_chatRoomWidget->sendImages(event->mimeData()))
+        event->acceptProposedAction();
+    else
+        QLineEdit::dropEvent(event);
+}
+
 ChatRoomWidget::ChatRoomWidget(QWidget* parent)
     : QWidget(parent)
 {
     m_messageModel = new MessageEventModel(this);
     m_currentRoom = nullptr;
     m_currentConnection = nullptr;
+    m_downloadManager = nullptr;
+    m_uploadManager = nullptr;
+    m_outgoingQueue = nullptr;
     m_completing = false;
 
     //m_messageView = new QListView();
@@ -93,6 +133,7 @@ ChatRoomWidget::ChatRoomWidget(QWidget* parent)
 
     QObject* rootItem = m_quickView->rootObject();
     connect( rootItem, SIGNAL(getPreviousContent()), this, SLOT(getPreviousContent()) );
+    connect( rootItem, SIGNAL(showImage(int)), this, SLOT(showImage(int)) );
 
 
     m_chatEdit = new ChatEdit(this);
@@ -141,6 +182,7 @@ void ChatRoomWidget::setRoom(QuaternionRoom* room)
     m_currentRoom = room;
     if( m_currentRoom )
     {
+        m_currentRoom->hydrate(); // Messages are only built for rooms that are shown
         m_chatEdit->setText( m_currentRoom->cachedInput() );
         connect( m_currentRoom, &QMatrixClient::Room::typingChanged, this, &ChatRoomWidget::typingChanged );
         connect( m_currentRoom, &QMatrixClient::Room::topicChanged, this, &ChatRoomWidget::topicChanged );
@@ -157,12 +199,30 @@ void ChatRoomWidget::setRoom(QuaternionRoom* room)
     QMetaObject::invokeMethod(rootItem, "scrollToBottom");
 }
 
-void ChatRoomWidget::setConnection(QMatrixClient::Connection* connection)
+void ChatRoomWidget::setConnection(QuaternionConnection* connection)
 {
     setRoom(nullptr);
+    m_messageModel->setDownloadManager(nullptr);
+    delete m_downloadManager;
+    m_downloadManager = nullptr;
+    delete m_uploadManager;
+    m_uploadManager = nullptr;
+    delete m_outgoingQueue;
+    m_outgoingQueue = nullptr;
+    m_imagesToShow.clear();
+
     m_currentConnection = connection;
     m_imageProvider->setConnection(connection);
     m_messageModel->setConnection(connection);
+    if (connection)
+    {
+        m_downloadManager = new DownloadManager(connection, this);
+        m_messageModel->setDownloadManager(m_downloadManager);
+        connect( m_downloadManager, &DownloadManager::stateChanged,
+                 this, &ChatRoomWidget::imageDownloaded );
+        m_uploadManager = new UploadManager(connection, this);
+        m_outgoingQueue = new OutgoingQueue(connection, this);
+    }
 }
 
 void ChatRoomWidget::typingChanged()
@@ -192,6 +252,93 @@ void ChatRoomWidget::getPreviousContent()
         m_currentRoom->getPreviousContent();
 }
 
+void ChatRoomWidget::showImage(int row)
+{
+    using namespace QMatrixClient;
+    if (!m_currentRoom || !m_downloadManager ||
+            row < 0 || row >= m_currentRoom->messages().count())
+        return;
+
+    Event* event = m_currentRoom->messages().at(row)->messageEvent();
+    if (!event || event->type() != EventType::RoomMessage)
+        return;
+    auto e = static_cast<RoomMessageEvent*>(event);
+    if (e->msgtype() != MessageEventType::Image)
+        return;
+    auto content = static_cast<MessageEventContent::ImageContent*>(e->content());
+
+    // Full-size images go to the cache, named after their media ids
+    QString cacheDir =
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/media";
+    QString fileName = content->url.host() + content->url.path().replace('/', '_');
+    QString path = QDir(cacheDir).filePath(fileName);
+    if (QFile::exists(path))
+    {
+        (new ImageViewer(path, this))->show();
+        return;
+    }
+    m_imagesToShow.insert(e->id());
+    m_downloadManager->download(e->id(), content->url, fileName, cacheDir);
+    emit showStatusMessage(tr("Downloading %1...").arg(e->body()), 3000);
+}
+
+void ChatRoomWidget::imageDownloaded(const QString& eventId)
+{
+    if (!m_imagesToShow.contains(eventId))
+        return;
+    switch (m_downloadManager->state(eventId))
+    {
+        case DownloadManager::Finished:
+            m_imagesToShow.remove(eventId);
+            (new ImageViewer(m_downloadManager->localFile(eventId), this))->show();
+            break;
+        case DownloadManager::Failed:
+            m_imagesToShow.remove(eventId);
+            emit showStatusMessage(tr("Couldn't download the image"), 5000);
+            break;
+        default:;
+    }
+}
+
+bool ChatRoomWidget::sendImages(const QMimeData* mimeData)
+{
+    if (!m_currentRoom || !m_uploadManager || !mimeData)
+        return false;
+
+    bool sent = false;
+    for (const QUrl& url: mimeData->urls())
+    {
+        // Only the format is detected here; decoding is up to UploadManager
+        if (url.isLocalFile() && !QImageReader::imageFormat(url.toLocalFile()).isEmpty())
+        {
+            m_uploadManager->uploadImage(m_currentRoom, url.toLocalFile());
+            sent = true;
+        }
+    }
+    if (!sent)
+    {
+        // Pasted images are passed on still encoded, so that decoding
+        // happens on UploadManager's worker thread too
+        QStringList formats;
+        formats << "image/png" << "image/jpeg" << "image/gif";
+        for (const QString& format: mimeData->formats())
+            if (format.startsWith("image/") && !formats.contains(format) &&
+                    QImageReader::supportedMimeTypes().contains(format.toLatin1()))
+                formats << format;
+        for (const QString& format: formats)
+        {
+            const QByteArray data = mimeData->data(format);
+            if (!data.isEmpty())
+            {
+                m_uploadManager->uploadImage(m_currentRoom, data);
+                sent = true;
+                break;
+            }
+        }
+    }
+    return sent;
+}
+
 void ChatRoomWidget::sendLine()
 {
     qDebug() << "sendLine";
@@ -223,38 +370,26 @@ void ChatRoomWidget::sendLine()
             else if( text.startsWith("/me") )
             {
                 text.remove(0, 3);
-                m_currentConnection->postMessage(m_currentRoom, "m.emote", text);
+                m_outgoingQueue->send(m_currentRoom, "m.emote", text);
             }
             else if( text.startsWith("//") )
             {
                 text.remove(0, 1);
-                m_currentConnection->postMessage(m_currentRoom, "m.text", text);
+                m_outgoingQueue->send(m_currentRoom, "m.text", text);
             }
             else if( text.startsWith("/") )
             {
                 emit showStatusMessage( "Unknown command. Use // to send this line literally", 5000);
                 return;
             } else
-                m_currentConnection->postMessage(m_currentRoom, "m.text", text);
+                m_outgoingQueue->send(m_currentRoom, "m.text", text);
         }
     m_chatEdit->setText("");
 }
 
 void ChatRoomWidget::findCompletionMatches(const QString& pattern)
 {
-    for( QMatrixClient::User* user: m_currentRoom->users() )
-    {
-        QString name = m_currentRoom->roomMembername(user);
-        if ( name.startsWith(pattern, Qt::CaseInsensitive) )
-        {
-            int ircSuffixPos = name.indexOf(" (IRC)");
-            if ( ircSuffixPos != -1 )
-                name.truncate(ircSuffixPos);
-            m_completionList.append(name);
-        }
-    }
-    m_completionList.sort(Qt::CaseInsensitive);
-    m_completionList.removeDuplicates();
+    m_completionList = m_currentRoom->completionIndex()->complete(pattern);
 }
 
 void ChatRoomWidget::cancelCompletion()
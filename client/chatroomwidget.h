@@ -21,6 +21,7 @@
 #define CHATROOMWIDGET_H
 
 #include <QtWidgets/QWidget>
+#include <QtCore/QSet>
 
 namespace QMatrixClient
 {
@@ -31,7 +32,12 @@ namespace QMatrixClient
 }
 class MessageEventModel;
 class QuaternionRoom;
+class QuaternionConnection;
 class ImageProvider;
+class DownloadManager;
+class UploadManager;
+class OutgoingQueue;
+class QMimeData;
 class QQuickView;
 class QListView;
 class QLineEdit;
@@ -48,6 +54,8 @@ class ChatRoomWidget: public QWidget
         void triggerCompletion();
         void cancelCompletion();
         void lookAtRoom();
+        /** Uploads the images in mimeData; returns false if there are none */
+        bool sendImages(const QMimeData* mimeData);
 
     signals:
         void joinRoomNeedsInteraction();
@@ -55,18 +63,24 @@ class ChatRoomWidget: public QWidget
 
     public slots:
         void setRoom(QuaternionRoom* room);
-        void setConnection(QMatrixClient::Connection* connection);
+        void setConnection(QuaternionConnection* connection);
         void topicChanged();
         void typingChanged();
         void getPreviousContent();
+        void showImage(int row);
 
     private slots:
         void sendLine();
+        void imageDownloaded(const QString& eventId);
 
     private:
         MessageEventModel* m_messageModel;
         QuaternionRoom* m_currentRoom;
-        QMatrixClient::Connection* m_currentConnection;
+        QuaternionConnection* m_currentConnection;
+        DownloadManager* m_downloadManager;
+        UploadManager* m_uploadManager;
+        OutgoingQueue* m_outgoingQueue;
+        QSet<QString> m_imagesToShow;
         bool m_completing;
         QStringList m_completionList;
         int m_completionListPosition;
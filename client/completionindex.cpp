@@ -0,0 +1,142 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "completionindex.h"
+
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+
+#include "lib/room.h"
+#include "lib/user.h"
+
+#include <algorithm>
+
+using namespace QMatrixClient;
+
+static const QString IrcSuffix = " (IRC)";
+
+CompletionIndex::CompletionIndex(Room* room)
+    : QObject(room)
+    , m_room(room)
+{
+    const auto users = room->users();
+    m_entries.reserve(users.size());
+    m_keys.reserve(users.size());
+    for (User* u: users)
+    {
+        Entry e = entryFor(u);
+        m_entries.push_back(e);
+        m_keys.insert(u, e.key);
+    }
+    std::sort(m_entries.begin(), m_entries.end());
+
+    connect( room, &Room::userAdded, this, &CompletionIndex::userAdded );
+    connect( room, &Room::userRemoved, this, &CompletionIndex::userRemoved );
+    connect( room, &Room::memberRenamed, this, &CompletionIndex::memberRenamed );
+}
+
+QStringList CompletionIndex::complete(const QString& prefix) const
+{
+    const QString key = prefix.toCaseFolded();
+    Entry probe { key, QString(), nullptr };
+    QVector< QPair<qint64, int> > ranked;
+    for (int i = lowerBound(probe);
+         i < m_entries.size() && m_entries.at(i).key.startsWith(key); ++i)
+    {
+        qint64 lastActivity = m_lastActivity.value(m_entries.at(i).user->id(), 0);
+        // Negated, so that sorting puts recent speakers first and keeps
+        // the rest in alphabetical order
+        ranked.push_back(qMakePair(-lastActivity, i));
+    }
+    std::sort(ranked.begin(), ranked.end());
+
+    QStringList result;
+    result.reserve(ranked.size());
+    QSet<QString> seen;
+    for (const auto& r: ranked)
+    {
+        const QString& name = m_entries.at(r.second).name;
+        if (!seen.contains(name))
+        {
+            seen.insert(name);
+            result.push_back(name);
+        }
+    }
+    return result;
+}
+
+void CompletionIndex::noteActivity(const QString& userId, qint64 timestamp)
+{
+    auto it = m_lastActivity.find(userId);
+    if (it == m_lastActivity.end())
+        m_lastActivity.insert(userId, timestamp);
+    else if (*it < timestamp)
+        *it = timestamp;
+}
+
+CompletionIndex::Entry CompletionIndex::entryFor(User* user) const
+{
+    QString name = m_room->roomMembername(user);
+    int ircSuffixPos = name.indexOf(IrcSuffix);
+    if (ircSuffixPos != -1)
+        name.truncate(ircSuffixPos);
+    Entry e { name.toCaseFolded(), name, user };
+    return e;
+}
+
+int CompletionIndex::lowerBound(const Entry& probe) const
+{
+    return std::lower_bound(m_entries.begin(), m_entries.end(), probe) - m_entries.begin();
+}
+
+void CompletionIndex::insert(User* user)
+{
+    Entry e = entryFor(user);
+    m_entries.insert(lowerBound(e), e);
+    m_keys.insert(user, e.key);
+}
+
+void CompletionIndex::remove(User* user)
+{
+    auto it = m_keys.find(user);
+    if (it == m_keys.end())
+        return;
+    Entry probe { *it, QString(), user };
+    int pos = lowerBound(probe);
+    if (pos < m_entries.size() && m_entries.at(pos).user == user)
+        m_entries.remove(pos);
+    m_keys.erase(it);
+}
+
+void CompletionIndex::userAdded(User* user)
+{
+    if (!m_keys.contains(user))
+        insert(user);
+}
+
+void CompletionIndex::userRemoved(User* user)
+{
+    remove(user);
+}
+
+void CompletionIndex::memberRenamed(User* user)
+{
+    remove(user);
+    insert(user);
+}
@@ -0,0 +1,87 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef COMPLETIONINDEX_H
+#define COMPLETIONINDEX_H
+
+#include <QtCore/QObject>
+#include <QtCore/QVector>
+#include <QtCore/QHash>
+#include <QtCore/QStringList>
+
+namespace QMatrixClient
+{
+    class Room;
+    class User;
+}
+
+/**
+ * Nick completion candidates of a room.
+ *
+ * Member names are stored once, with the " (IRC)" suffix of bridged users
+ * already stripped, in an array sorted by their case-folded form. Finding
+ * the completions for a prefix is a binary search plus a scan over the
+ * matches, which are then ranked by how recently each member spoke. The
+ * index follows joins, leaves and renames incrementally.
+ */
+class CompletionIndex: public QObject
+{
+        Q_OBJECT
+    public:
+        explicit CompletionIndex(QMatrixClient::Room* room);
+
+        /**
+         * Returns names starting with the prefix (case-insensitively), the
+         * most recent speakers first.
+         */
+        QStringList complete(const QString& prefix) const;
+
+        /** Records that the user sent something at the given time */
+        void noteActivity(const QString& userId, qint64 timestamp);
+
+    private slots:
+        void userAdded(QMatrixClient::User* user);
+        void userRemoved(QMatrixClient::User* user);
+        void memberRenamed(QMatrixClient::User* user);
+
+    private:
+        struct Entry
+        {
+            QString key;
+            QString name;
+            QMatrixClient::User* user;
+
+            bool operator<(const Entry& other) const
+            {
+                return key < other.key || (key == other.key && user < other.user);
+            }
+        };
+
+        QMatrixClient::Room* m_room;
+        QVector<Entry> m_entries;
+        QHash<QMatrixClient::User*, QString> m_keys;
+        QHash<QString, qint64> m_lastActivity;
+
+        Entry entryFor(QMatrixClient::User* user) const;
+        int lowerBound(const Entry& probe) const;
+        void insert(QMatrixClient::User* user);
+        void remove(QMatrixClient::User* user);
+};
+
+#endif // COMPLETIONINDEX_H
@@ -0,0 +1,319 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "downloadmanager.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDir>
+#include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QDebug>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+#include "quaternionconnection.h"
+
+// Keeps at most this much of a response in memory before it goes to disk
+static const qint64 ChunkSize = 256 * 1024;
+static const qint64 ProgressInterval = 100; // ms
+
+DownloadManager::DownloadManager(QuaternionConnection* connection, QObject* parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_active(0)
+    , m_maxConcurrent(QSettings().value("Network/max_concurrent_downloads", 2).toInt())
+{
+    // Interrupted transfers are retried as soon as the server is reachable
+    // again; the sync loop finds that out first
+    connect( m_connection, &QMatrixClient::Connection::syncDone,
+             this, &DownloadManager::resumeInterrupted );
+    m_progressTimer.start();
+}
+
+DownloadManager::~DownloadManager()
+{
+    for (auto& t: m_transfers)
+    {
+        if (t.reply)
+        {
+            t.reply->disconnect(this);
+            t.reply->abort();
+            t.reply->deleteLater();
+        }
+        delete t.file; // The .part file is kept for the next session
+    }
+}
+
+void DownloadManager::download(const QString& eventId, const QUrl& mxcUrl,
+                               const QString& fileName, const QString& targetDir)
+{
+    auto it = m_transfers.find(eventId);
+    if (it != m_transfers.end())
+    {
+        if (it->state == Interrupted || it->state == Failed)
+        {
+            m_queue.enqueue(eventId);
+            setState(eventId, Queued);
+            startNext();
+        }
+        return;
+    }
+
+    QDir dir(targetDir.isEmpty()
+             ? QStandardPaths::writableLocation(QStandardPaths::DownloadLocation)
+             : targetDir);
+    dir.mkpath(".");
+    Transfer t { mxcUrl, dir.path(), uniqueTargetPath(dir, fileName),
+                 Queued, nullptr, nullptr, 0, -1 };
+    m_transfers.insert(eventId, t);
+    m_queue.enqueue(eventId);
+    emit stateChanged(eventId);
+    startNext();
+}
+
+void DownloadManager::cancel(const QString& eventId)
+{
+    auto it = m_transfers.find(eventId);
+    if (it == m_transfers.end())
+        return;
+
+    m_queue.removeAll(eventId);
+    if (it->reply)
+    {
+        it->reply->disconnect(this);
+        it->reply->abort();
+        it->reply->deleteLater();
+        --m_active;
+    }
+    if (it->file)
+    {
+        it->file->remove();
+        delete it->file;
+    }
+    m_transfers.erase(it);
+    emit stateChanged(eventId);
+    startNext();
+}
+
+DownloadManager::State DownloadManager::state(const QString& eventId) const
+{
+    auto it = m_transfers.find(eventId);
+    return it == m_transfers.end() ? NotStarted : it->state;
+}
+
+qreal DownloadManager::progress(const QString& eventId) const
+{
+    auto it = m_transfers.find(eventId);
+    if (it == m_transfers.end() || it->total <= 0)
+        return -1;
+    return qreal(it->received) / it->total;
+}
+
+QString DownloadManager::localFile(const QString& eventId) const
+{
+    auto it = m_transfers.find(eventId);
+    if (it == m_transfers.end() || it->state != Finished)
+        return QString();
+    return it->targetPath;
+}
+
+int DownloadManager::maxConcurrent() const
+{
+    return m_maxConcurrent;
+}
+
+void DownloadManager::setMaxConcurrent(int max)
+{
+    m_maxConcurrent = qMax(1, max);
+    startNext();
+}
+
+void DownloadManager::resumeInterrupted()
+{
+    for (auto it = m_transfers.begin(); it != m_transfers.end(); ++it)
+        if (it->state == Interrupted)
+        {
+            it->state = Queued;
+            m_queue.enqueue(it.key());
+            emit stateChanged(it.key());
+        }
+    startNext();
+}
+
+void DownloadManager::startNext()
+{
+    while (m_active < m_maxConcurrent && !m_queue.isEmpty())
+        start(m_queue.dequeue());
+}
+
+void DownloadManager::start(const QString& eventId)
+{
+    Transfer& t = m_transfers[eventId];
+    if (!t.file)
+        t.file = new QFile(partialPath(eventId, t));
+    if (!t.file->open(QIODevice::ReadWrite))
+    {
+        qWarning() << "Couldn't open" << t.file->fileName() << "for writing";
+        setState(eventId, Failed);
+        return;
+    }
+    t.received = t.file->size();
+    t.file->seek(t.received);
+
+    QNetworkRequest request(m_connection->mediaUrl(t.url));
+    if (t.received > 0)
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(t.received) + "-");
+
+    t.reply = m_connection->nam()->get(request);
+    t.reply->setReadBufferSize(ChunkSize);
+    ++m_active;
+    setState(eventId, Active);
+
+    connect( t.reply, &QNetworkReply::readyRead, this, [=] { readChunk(eventId); } );
+    connect( t.reply, &QNetworkReply::finished, this, [=] { finished(eventId); } );
+}
+
+void DownloadManager::readChunk(const QString& eventId)
+{
+    Transfer& t = m_transfers[eventId];
+    if (t.total < 0)
+    {
+        int status = t.reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (status != 206 && t.received > 0)
+        {
+            // The server ignored the Range header; start over
+            t.file->resize(0);
+            t.file->seek(0);
+            t.received = 0;
+        }
+        qint64 length = t.reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+        t.total = length > 0 ? t.received + length : 0;
+    }
+
+    while (t.reply->bytesAvailable() > 0)
+    {
+        QByteArray chunk = t.reply->read(ChunkSize);
+        if (t.file->write(chunk) != chunk.size())
+        {
+            qWarning() << "Error writing to" << t.file->fileName() << t.file->errorString();
+            // Resuming won't help with a full or read-only disk; finished()
+            // sees the state and doesn't take the abort for an interruption
+            setState(eventId, Failed);
+            t.reply->abort();
+            return;
+        }
+        t.received += chunk.size();
+    }
+
+    if (m_progressTimer.elapsed() >= ProgressInterval)
+    {
+        m_progressTimer.restart();
+        emit progressChanged(eventId);
+    }
+}
+
+void DownloadManager::finished(const QString& eventId)
+{
+    Transfer& t = m_transfers[eventId];
+    --m_active;
+    QNetworkReply* reply = t.reply;
+    t.reply = nullptr;
+    reply->deleteLater();
+    t.file->close();
+
+    if (t.state == Failed)
+    {
+        // Writing to the disk failed in readChunk()
+        t.file->remove();
+        delete t.file;
+        t.file = nullptr;
+        t.total = -1;
+    }
+    else if (reply->error() == QNetworkReply::NoError && t.file->error() == QFile::NoError)
+    {
+        if (!t.file->rename(t.targetPath))
+            t.targetPath = t.file->fileName();
+        delete t.file;
+        t.file = nullptr;
+        t.total = t.received;
+        setState(eventId, Finished);
+        emit progressChanged(eventId);
+    }
+    else if (reply->error() >= QNetworkReply::ContentAccessDenied &&
+             reply->error() < QNetworkReply::ProtocolUnknownError)
+    {
+        qWarning() << "Download of" << t.url << "failed:" << reply->errorString();
+        t.file->remove();
+        delete t.file;
+        t.file = nullptr;
+        setState(eventId, Failed);
+    }
+    else
+    {
+        // A network problem; the .part file is kept for resuming
+        qDebug() << "Download of" << t.url << "interrupted at" << t.received << "bytes";
+        t.total = -1;
+        setState(eventId, Interrupted);
+    }
+    startNext();
+}
+
+void DownloadManager::setState(const QString& eventId, State state)
+{
+    m_transfers[eventId].state = state;
+    emit stateChanged(eventId);
+}
+
+QString DownloadManager::partialPath(const QString& eventId, const Transfer& t) const
+{
+    // Named after the media id, so that a download interrupted in
+    // a previous session is picked up again; the same media can be
+    // attached to several events, which are downloaded separately
+    QString mediaId = t.url.host() + t.url.path();
+    mediaId.replace('/', '_');
+    const QString eventHash = QString::fromLatin1(
+        QCryptographicHash::hash(eventId.toUtf8(), QCryptographicHash::Sha1).toHex().left(16));
+    return QDir(t.targetDir).filePath("." + mediaId + "_" + eventHash + ".part");
+}
+
+bool DownloadManager::isPathTaken(const QString& path) const
+{
+    if (QFile::exists(path))
+        return true;
+    for (const auto& t: m_transfers)
+        if (t.targetPath == path)
+            return true;
+    return false;
+}
+
+QString DownloadManager::uniqueTargetPath(const QDir& dir, const QString& fileName) const
+{
+    QFileInfo fi(fileName.isEmpty() ? QString("download") : QFileInfo(fileName).fileName());
+    QString path = dir.filePath(fi.fileName());
+    for (int i = 1; isPathTaken(path); ++i)
+    {
+        QString name = fi.completeBaseName() + QString(" (%1)").arg(i);
+        if (!fi.suffix().isEmpty())
+            name += "." + fi.suffix();
+        path = dir.filePath(name);
+    }
+    return path;
+}
@@ -0,0 +1,108 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef DOWNLOADMANAGER_H
+#define DOWNLOADMANAGER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QQueue>
+#include <QtCore/QUrl>
+#include <QtCore/QElapsedTimer>
+
+class QuaternionConnection;
+class QNetworkReply;
+class QFile;
+class QDir;
+
+/**
+ * Downloads media attachments straight to disk.
+ *
+ * Data is written to a ".part" file as it arrives, so memory use doesn't
+ * depend on the file size. Interrupted transfers keep their partial file
+ * (named after the media and event ids) and continue with an HTTP Range
+ * request when the connection comes back or the download is requested
+ * again.
+ * At most "Network/max_concurrent_downloads" transfers run at a time; the
+ * rest wait in a queue.
+ */
+class DownloadManager: public QObject
+{
+        Q_OBJECT
+    public:
+        enum State { NotStarted, Queued, Active, Interrupted, Finished, Failed };
+
+        DownloadManager(QuaternionConnection* connection, QObject* parent = nullptr);
+        virtual ~DownloadManager();
+
+        /**
+         * Starts (or resumes) downloading the media of the given event
+         * into targetDir (the user's download location by default)
+         */
+        void download(const QString& eventId, const QUrl& mxcUrl,
+                      const QString& fileName,
+                      const QString& targetDir = QString());
+        void cancel(const QString& eventId);
+
+        State state(const QString& eventId) const;
+        /** Returns the progress in range [0, 1] or -1 if unknown */
+        qreal progress(const QString& eventId) const;
+        QString localFile(const QString& eventId) const;
+
+        int maxConcurrent() const;
+        void setMaxConcurrent(int max);
+
+    signals:
+        void progressChanged(const QString& eventId);
+        void stateChanged(const QString& eventId);
+
+    private slots:
+        void resumeInterrupted();
+
+    private:
+        struct Transfer
+        {
+            QUrl url;
+            QString targetDir;
+            QString targetPath;
+            State state;
+            QFile* file;
+            QNetworkReply* reply;
+            qint64 received;
+            qint64 total;
+        };
+
+        QuaternionConnection* m_connection;
+        QHash<QString, Transfer> m_transfers;
+        QQueue<QString> m_queue;
+        int m_active;
+        int m_maxConcurrent;
+        QElapsedTimer m_progressTimer;
+
+        void startNext();
+        void start(const QString& eventId);
+        void readChunk(const QString& eventId);
+        void finished(const QString& eventId);
+        void setState(const QString& eventId, State state);
+        QString partialPath(const QString& eventId, const Transfer& t) const;
+        bool isPathTaken(const QString& path) const;
+        QString uniqueTargetPath(const QDir& dir, const QString& fileName) const;
+};
+
+#endif // DOWNLOADMANAGER_H
@@ -26,9 +26,14 @@
 
 #include <QtCore/QDebug>
 
+const QString ImageProvider::PreviewPrefix = "preview/";
+static const QSize PreviewSize { 32, 32 };
+
 ImageProvider::ImageProvider(QMatrixClient::Connection* connection)
     : QQuickImageProvider(QQmlImageProviderBase::Pixmap, QQmlImageProviderBase::ForceAsynchronousImageLoading)
     , m_connection(connection)
+    , m_previews(2000) // Roughly 8 MB of 32x32 previews
+    , m_previewsOversized(false)
 {
     qRegisterMetaType<QPixmap*>();
     qRegisterMetaType<QWaitCondition*>();
@@ -39,6 +44,15 @@ QPixmap ImageProvider::requestPixmap(const QString& id, QSize* size, const QSize
     QMutexLocker locker(&m_mutex);
     qDebug() << "ImageProvider::requestPixmap:" << id;
 
+    if (QPixmap* preview = m_previews.object(id))
+    {
+        if( size != nullptr )
+            *size = preview->size();
+        return *preview;
+    }
+    if (m_previewsOversized && id.startsWith(PreviewPrefix))
+        return QPixmap();
+
     QWaitCondition condition;
     QPixmap result;
     QMetaObject::invokeMethod(this, "doRequest", Qt::QueuedConnection,
@@ -64,19 +78,29 @@ void ImageProvider::doRequest(QString id, QSize requestedSize, QPixmap* pixmap,
 {
     QMutexLocker locker(&m_mutex);
 
-    int width = requestedSize.width() > 0 ? requestedSize.width() : 100;
-    int height = requestedSize.height() > 0 ? requestedSize.height() : 100;
-
     if( !m_connection )
     {
         qDebug() << "ImageProvider::requestPixmap: no connection!";
         *pixmap = QPixmap();
         condition->wakeAll();
+        return;
     }
 
-    QMatrixClient::MediaThumbnailJob* job = m_connection->getThumbnail(QUrl(id), width, height);
+    QString mediaId = id;
+    QString previewId;
+    QSize size = requestedSize;
+    if (id.startsWith(PreviewPrefix))
+    {
+        previewId = id;
+        mediaId.remove(0, PreviewPrefix.size());
+        size = PreviewSize;
+    }
+    int width = size.width() > 0 ? size.width() : 100;
+    int height = size.height() > 0 ? size.height() : 100;
+
+    QMatrixClient::MediaThumbnailJob* job = m_connection->getThumbnail(QUrl(mediaId), width, height);
     QObject::connect( job, &QMatrixClient::MediaThumbnailJob::success, this, &ImageProvider::gotImage );
-    ImageProviderData data = { pixmap, condition, requestedSize };
+    ImageProviderData data = { pixmap, condition, QSize(width, height), previewId };
     m_callmap.insert(job, data);
 }
 
@@ -87,6 +111,19 @@ void ImageProvider::gotImage(QMatrixClient::BaseJob* job)
 
     auto mediaJob = static_cast<QMatrixClient::MediaThumbnailJob*>(job);
     ImageProviderData data = m_callmap.take(mediaJob);
+    const QSize received = mediaJob->thumbnail().size();
+    if (!data.previewId.isEmpty() && !m_previewsOversized &&
+            received.width() > 4 * PreviewSize.width() &&
+            received.height() > 4 * PreviewSize.height())
+    {
+        // Servers only have the sizes they're configured for; with "scale"
+        // the smallest may be far bigger than a preview needs
+        qDebug() << "The server sent a" << received << "thumbnail for a preview;"
+                 << "not requesting previews anymore";
+        m_previewsOversized = true;
+    }
     *data.pixmap = mediaJob->thumbnail().scaled(data.requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    if (!data.previewId.isEmpty() && !data.pixmap->isNull())
+        m_previews.insert(data.previewId, new QPixmap(*data.pixmap));
     data.condition->wakeAll();
 }
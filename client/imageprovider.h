@@ -24,6 +24,7 @@
 #include <QtCore/QThread>
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
+#include <QtCore/QCache>
 
 #include <lib/jobs/basejob.h>
 #include "quaternionconnection.h"
@@ -33,12 +34,21 @@ struct ImageProviderData
     QPixmap* pixmap;
     QWaitCondition* condition;
     QSize requestedSize;
+    QString previewId; // Non-empty for preview requests
 };
 
 class ImageProvider: public QObject, public QQuickImageProvider
 {
         Q_OBJECT
     public:
+        /**
+         * Ids starting with this prefix get a tiny preview of the image,
+         * which is cheap to fetch and gives the aspect ratio early. If the
+         * server answers preview requests with much bigger thumbnails,
+         * previews are turned off, since they'd only add traffic.
+         */
+        static const QString PreviewPrefix;
+
         ImageProvider(QMatrixClient::Connection* connection);
 
         QPixmap requestPixmap(const QString& id, QSize* size, const QSize& requestedSize);
@@ -53,6 +63,8 @@ class ImageProvider: public QObject, public QQuickImageProvider
 
         QMatrixClient::Connection* m_connection;
         QHash<QMatrixClient::MediaThumbnailJob*, ImageProviderData> m_callmap;
+        QCache<QString, QPixmap> m_previews;
+        bool m_previewsOversized;
         QMutex m_mutex;
 };
 
@@ -0,0 +1,405 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "imageviewer.h"
+
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDebug>
+#include <QtGui/QImageReader>
+#include <QtGui/QPainter>
+#include <QtGui/QWheelEvent>
+#include <QtGui/QMouseEvent>
+#include <QtGui/QKeyEvent>
+
+#include <cmath>
+
+static const int TileSize = 256;
+static const int OverviewSize = 512;
+static const qreal MaxZoom = 8.0;
+static const int OverviewLevel = -1;
+
+class DecodeTask: public QRunnable
+{
+    public:
+        DecodeTask(TileDecoder* decoder, QString fileName,
+                   TileKey key, QSize levelSize, QRect levelRect)
+            : m_decoder(decoder), m_fileName(fileName)
+            , m_key(key), m_levelSize(levelSize), m_levelRect(levelRect)
+        { }
+
+        void run() override
+        {
+            if (m_key.level != OverviewLevel && !m_decoder->m_partialDecoding)
+            {
+                m_decoder->decodeLevel(m_key, m_levelSize);
+                return;
+            }
+
+            QImageReader reader(m_fileName);
+            if (m_key.level == OverviewLevel)
+                reader.setScaledSize(m_levelSize);
+            else if (m_key.level == 0)
+                reader.setClipRect(m_levelRect);
+            else
+            {
+                reader.setScaledSize(m_levelSize);
+                reader.setScaledClipRect(m_levelRect);
+            }
+            QImage image = reader.read();
+            if (image.isNull())
+                qWarning() << "Couldn't decode" << m_fileName << reader.errorString();
+            emit m_decoder->decoded(m_key, image);
+        }
+
+    private:
+        TileDecoder* m_decoder;
+        QString m_fileName;
+        TileKey m_key;
+        QSize m_levelSize;
+        QRect m_levelRect;
+};
+
+TileDecoder::TileDecoder(const QString& fileName, QObject* parent)
+    : QObject(parent)
+    , m_fileName(fileName)
+{
+    qRegisterMetaType<TileKey>();
+    QImageReader reader(fileName);
+    m_partialDecoding = reader.supportsOption(QImageIOHandler::ClipRect) &&
+                        reader.supportsOption(QImageIOHandler::ScaledClipRect);
+    // Without partial decoding every decode takes memory for the whole
+    // level, so only one runs at a time
+    m_pool.setMaxThreadCount(m_partialDecoding
+                             ? qMax(1, QThread::idealThreadCount() / 2) : 1);
+    m_overviewPool.setMaxThreadCount(1);
+}
+
+TileDecoder::~TileDecoder()
+{
+    cancelPending();
+    m_pool.waitForDone();
+    m_overviewPool.waitForDone();
+}
+
+void TileDecoder::decodeLevel(TileKey key, QSize levelSize)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        if (!m_wanted.contains(key))
+            return; // Cut from an earlier decode of the level, or cancelled
+    }
+
+    QImageReader reader(m_fileName);
+    if (key.level != 0)
+        reader.setScaledSize(levelSize);
+    const QImage level = reader.read();
+    if (level.isNull())
+        qWarning() << "Couldn't decode" << m_fileName << reader.errorString();
+
+    // The level image is dropped after this, so every tile the viewer waits
+    // for is cut now, along with the ones around it for a bit of panning
+    QList<TileKey> wanted;
+    QSet<TileKey> around;
+    {
+        QMutexLocker lock(&m_mutex);
+        for (auto it = m_wanted.begin(); it != m_wanted.end(); )
+        {
+            if (it->level == key.level)
+            {
+                wanted.push_back(*it);
+                it = m_wanted.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+    const QRect levelRect(QPoint(0, 0), level.size());
+    for (const TileKey& k: wanted)
+        for (int y = k.y - 1; y <= k.y + 1; ++y)
+            for (int x = k.x - 1; x <= k.x + 1; ++x)
+                around.insert({ k.level, x, y });
+    for (const TileKey& k: wanted)
+        around.remove(k);
+
+    // The wanted tiles go last, so the viewer's cache drops the others first
+    for (const TileKey& k: around)
+    {
+        const QRect r = QRect(k.x * TileSize, k.y * TileSize, TileSize, TileSize)
+                .intersected(levelRect);
+        if (!r.isEmpty())
+            emit decoded(k, level.copy(r));
+    }
+    for (const TileKey& k: wanted)
+    {
+        const QRect r = QRect(k.x * TileSize, k.y * TileSize, TileSize, TileSize)
+                .intersected(levelRect);
+        emit decoded(k, level.isNull() || r.isEmpty() ? QImage() : level.copy(r));
+    }
+}
+
+void TileDecoder::request(TileKey key, QSize levelSize, QRect levelRect)
+{
+    if (!m_partialDecoding)
+    {
+        QMutexLocker lock(&m_mutex);
+        m_wanted.insert(key);
+    }
+    m_pool.start(new DecodeTask(this, m_fileName, key, levelSize, levelRect));
+}
+
+void TileDecoder::requestOverview(TileKey key, QSize size)
+{
+    m_overviewPool.start(new DecodeTask(this, m_fileName, key, size, QRect()));
+}
+
+void TileDecoder::cancelPending()
+{
+    m_pool.clear();
+    QMutexLocker lock(&m_mutex);
+    m_wanted.clear();
+}
+
+ImageViewer::ImageViewer(const QString& fileName, QWidget* parent)
+    : QWidget(parent, Qt::Window)
+    , m_fileName(fileName)
+    , m_zoom(1.0)
+    , m_fitToWindow(true)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setWindowTitle(QFileInfo(fileName).fileName());
+
+    // Only the header is read here; everything else is decoded on workers
+    QImageReader reader(fileName);
+    m_imageSize = reader.size();
+    if (!m_imageSize.isValid())
+        qWarning() << "Couldn't read" << fileName << reader.errorString();
+
+    m_decoder = new TileDecoder(fileName, this);
+    connect( m_decoder, &TileDecoder::decoded, this, &ImageViewer::tileDecoded );
+    if (m_imageSize.isValid())
+    {
+        QSize overviewSize = m_imageSize;
+        if (overviewSize.width() > OverviewSize || overviewSize.height() > OverviewSize)
+            overviewSize.scale(OverviewSize, OverviewSize, Qt::KeepAspectRatio);
+        m_decoder->requestOverview({ OverviewLevel, 0, 0 }, overviewSize);
+    }
+
+    resize(QSize(1024, 768).boundedTo(m_imageSize.isValid() ? m_imageSize : QSize(1024, 768)));
+}
+
+ImageViewer::~ImageViewer()
+{
+    // Make sure no worker emits into a half-destroyed viewer
+    delete m_decoder;
+}
+
+int ImageViewer::levelForZoom(qreal zoom) const
+{
+    // Pick the coarsest level that still has at least as many pixels as shown
+    if (zoom >= 1.0)
+        return 0;
+    return int(std::floor(std::log2(1.0 / zoom)));
+}
+
+QSize ImageViewer::levelSize(int level) const
+{
+    const int divisor = 1 << level;
+    return QSize((m_imageSize.width() + divisor - 1) / divisor,
+                 (m_imageSize.height() + divisor - 1) / divisor);
+}
+
+QRect ImageViewer::tileRect(const TileKey& key) const
+{
+    return QRect(key.x * TileSize, key.y * TileSize, TileSize, TileSize)
+            .intersected(QRect(QPoint(0, 0), levelSize(key.level)));
+}
+
+QRectF ImageViewer::tileTarget(const TileKey& key) const
+{
+    const qreal scale = m_zoom * (1 << key.level);
+    QRectF r = tileRect(key);
+    return QRectF((r.x() * (1 << key.level) - m_offset.x()) * m_zoom,
+                  (r.y() * (1 << key.level) - m_offset.y()) * m_zoom,
+                  r.width() * scale, r.height() * scale);
+}
+
+void ImageViewer::paintEvent(QPaintEvent*)
+{
+    QPainter p(this);
+    p.fillRect(rect(), palette().dark());
+    if (!m_imageSize.isValid())
+        return;
+
+    p.setRenderHint(QPainter::SmoothPixmapTransform);
+    const QRectF imageTarget(-m_offset * m_zoom, QSizeF(m_imageSize) * m_zoom);
+    if (!m_overview.isNull())
+        p.drawImage(imageTarget, m_overview);
+
+    const int level = levelForZoom(m_zoom);
+    const QRectF visible = QRectF(m_offset, QSizeF(size()) / m_zoom)
+            .intersected(QRectF(QPointF(0, 0), QSizeF(m_imageSize)));
+    if (visible.isEmpty())
+        return;
+    const qreal levelScale = 1.0 / (1 << level);
+    const int x1 = int(visible.left() * levelScale) / TileSize;
+    const int y1 = int(visible.top() * levelScale) / TileSize;
+    const int x2 = int(visible.right() * levelScale) / TileSize;
+    const int y2 = int(visible.bottom() * levelScale) / TileSize;
+
+    for (int y = y1; y <= y2; ++y)
+        for (int x = x1; x <= x2; ++x)
+        {
+            TileKey key { level, x, y };
+            if (QImage* tile = m_tiles.object(key))
+            {
+                p.drawImage(tileTarget(key), *tile);
+                continue;
+            }
+            // Fall back to a coarser tile that is already there
+            for (int coarser = level + 1; coarser <= level + 3; ++coarser)
+            {
+                const int shift = coarser - level;
+                TileKey parent { coarser, x >> shift, y >> shift };
+                if (QImage* tile = m_tiles.object(parent))
+                {
+                    p.save();
+                    p.setClipRect(tileTarget(key));
+                    p.drawImage(tileTarget(parent), *tile);
+                    p.restore();
+                    break;
+                }
+            }
+            if (!m_requested.contains(key))
+            {
+                m_requested.insert(key);
+                m_decoder->request(key, levelSize(level), tileRect(key));
+            }
+        }
+}
+
+void ImageViewer::tileDecoded(TileKey key, QImage image)
+{
+    m_requested.remove(key);
+    if (image.isNull())
+        return;
+    if (key.level == OverviewLevel)
+    {
+        m_overview = image;
+        update();
+        return;
+    }
+    m_tiles.insert(key, new QImage(image), image.byteCount());
+    update(tileTarget(key).toAlignedRect());
+}
+
+void ImageViewer::resizeEvent(QResizeEvent*)
+{
+    // Enough for the current view, a coarser fallback and some panning
+    const int viewportBytes = width() * height() * 4;
+    m_tiles.setMaxCost(qMax(viewportBytes * 4, 16 * 1024 * 1024));
+    if (m_fitToWindow)
+        fitToWindow();
+    viewChanged();
+}
+
+void ImageViewer::fitToWindow()
+{
+    if (!m_imageSize.isValid())
+        return;
+    m_zoom = qMin(1.0, qMin(qreal(width()) / m_imageSize.width(),
+                            qreal(height()) / m_imageSize.height()));
+    // Center the image
+    m_offset = QPointF(m_imageSize.width() - width() / m_zoom,
+                       m_imageSize.height() - height() / m_zoom) / 2;
+}
+
+void ImageViewer::zoomAt(qreal factor, QPointF widgetPos)
+{
+    if (!m_imageSize.isValid())
+        return;
+    const qreal minZoom = qMin(qreal(width()) / m_imageSize.width(),
+                               qreal(height()) / m_imageSize.height());
+    const qreal newZoom = qBound(qMin(minZoom, 1.0), m_zoom * factor, MaxZoom);
+    // Keep the image point under the cursor in place
+    const QPointF imagePos = m_offset + widgetPos / m_zoom;
+    m_zoom = newZoom;
+    m_offset = imagePos - widgetPos / m_zoom;
+    m_fitToWindow = false;
+    viewChanged();
+}
+
+void ImageViewer::viewChanged()
+{
+    // Tiles queued for the previous view are of no use anymore;
+    // those already being decoded will still land in the cache.
+    m_decoder->cancelPending();
+    m_requested.clear();
+    update();
+}
+
+void ImageViewer::wheelEvent(QWheelEvent* event)
+{
+    zoomAt(std::pow(1.2, event->angleDelta().y() / 120.0), event->pos());
+}
+
+void ImageViewer::mousePressEvent(QMouseEvent* event)
+{
+    m_dragStart = event->pos();
+}
+
+void ImageViewer::mouseMoveEvent(QMouseEvent* event)
+{
+    if (!(event->buttons() & Qt::LeftButton))
+        return;
+    m_offset -= QPointF(event->pos() - m_dragStart) / m_zoom;
+    m_dragStart = event->pos();
+    m_fitToWindow = false;
+    viewChanged();
+}
+
+void ImageViewer::keyPressEvent(QKeyEvent* event)
+{
+    const QPointF center = rect().center();
+    switch (event->key())
+    {
+        case Qt::Key_Plus:
+        case Qt::Key_Equal:
+            zoomAt(1.5, center);
+            break;
+        case Qt::Key_Minus:
+            zoomAt(1 / 1.5, center);
+            break;
+        case Qt::Key_1:
+            zoomAt(1.0 / m_zoom, center);
+            break;
+        case Qt::Key_0:
+            m_fitToWindow = true;
+            fitToWindow();
+            viewChanged();
+            break;
+        case Qt::Key_Escape:
+            close();
+            break;
+        default:
+            QWidget::keyPressEvent(event);
+    }
+}
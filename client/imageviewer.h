@@ -0,0 +1,137 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef IMAGEVIEWER_H
+#define IMAGEVIEWER_H
+
+#include <QtWidgets/QWidget>
+#include <QtCore/QCache>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImage>
+
+struct TileKey
+{
+    int level; // The image is scaled by 2^-level
+    int x;
+    int y;
+
+    bool operator==(const TileKey& other) const
+    {
+        return level == other.level && x == other.x && y == other.y;
+    }
+};
+Q_DECLARE_METATYPE(TileKey)
+
+inline uint qHash(const TileKey& key, uint seed = 0)
+{
+    return qHash((key.level << 24) ^ (key.x << 12) ^ key.y, seed);
+}
+
+/**
+ * Decodes tiles of an image file on worker threads. Each tile is read
+ * with QImageReader's clip rectangle and scaled size, so image formats
+ * that support it (notably JPEG) never have the whole image decoded.
+ */
+class TileDecoder: public QObject
+{
+        Q_OBJECT
+    public:
+        TileDecoder(const QString& fileName, QObject* parent = nullptr);
+        virtual ~TileDecoder();
+
+        void request(TileKey key, QSize levelSize, QRect levelRect);
+        /** Decodes the whole image at a (small) size; not affected by cancelPending() */
+        void requestOverview(TileKey key, QSize size);
+        /** Drops the tile requests that haven't started yet */
+        void cancelPending();
+
+    signals:
+        void decoded(TileKey key, QImage image);
+
+    private:
+        friend class DecodeTask;
+
+        QString m_fileName;
+        QThreadPool m_pool;
+        QThreadPool m_overviewPool;
+        /**
+         * Formats without partial decoding (e.g. PNG) decode a whole level
+         * anyway; it is then decoded on a single thread, all requested
+         * tiles of the level (and their neighbours) are cut from it at
+         * once, and the level image is dropped
+         */
+        bool m_partialDecoding;
+        QMutex m_mutex;
+        QSet<TileKey> m_wanted; // Requested, not decoded yet; guarded by m_mutex
+
+        /** Used by the tile thread only when partial decoding isn't supported */
+        void decodeLevel(TileKey key, QSize levelSize);
+};
+
+/**
+ * A window showing an image in full resolution.
+ *
+ * Only the part of the image in the viewport is decoded, at the zoom level
+ * shown; decoded tiles are kept in a cache bounded by a multiple of the
+ * viewport size. While tiles are decoded in the background, coarser tiles
+ * (or a small overview of the whole image) are painted in their place.
+ */
+class ImageViewer: public QWidget
+{
+        Q_OBJECT
+    public:
+        ImageViewer(const QString& fileName, QWidget* parent = nullptr);
+        virtual ~ImageViewer();
+
+    protected:
+        void paintEvent(QPaintEvent* event) override;
+        void resizeEvent(QResizeEvent* event) override;
+        void wheelEvent(QWheelEvent* event) override;
+        void mousePressEvent(QMouseEvent* event) override;
+        void mouseMoveEvent(QMouseEvent* event) override;
+        void keyPressEvent(QKeyEvent* event) override;
+
+    private slots:
+        void tileDecoded(TileKey key, QImage image);
+
+    private:
+        QString m_fileName;
+        QSize m_imageSize;
+        QImage m_overview;
+        TileDecoder* m_decoder;
+        QCache<TileKey, QImage> m_tiles;
+        QSet<TileKey> m_requested;
+
+        qreal m_zoom;
+        QPointF m_offset; // Image coordinates of the viewport's top left
+        QPoint m_dragStart;
+        bool m_fitToWindow;
+
+        int levelForZoom(qreal zoom) const;
+        QSize levelSize(int level) const;
+        QRect tileRect(const TileKey& key) const;
+        QRectF tileTarget(const TileKey& key) const;
+        void fitToWindow();
+        void zoomAt(qreal factor, QPointF widgetPos);
+        void viewChanged();
+};
+
+#endif // IMAGEVIEWER_H
@@ -37,13 +37,18 @@
 #include "userlistdock.h"
 #include "chatroomwidget.h"
 #include "logindialog.h"
+#include "roomdirectorydialog.h"
 #include "systemtray.h"
+#include "quickswitcher.h"
+#include "syncscheduler.h"
+#include "avatarcache.h"
 #include "settings.h"
 
 MainWindow::MainWindow()
 {
     setWindowIcon(QIcon(":/icon.png"));
     connection = nullptr;
+    syncScheduler = nullptr;
     roomListDock = new RoomListDock(this);
     addDockWidget(Qt::LeftDockWidgetArea, roomListDock);
     userListDock = new UserListDock(this);
@@ -55,6 +60,8 @@ MainWindow::MainWindow()
     connect( roomListDock, &RoomListDock::roomSelected, userListDock, &UserListDock::setRoom );
     connect( chatRoomWidget, &ChatRoomWidget::showStatusMessage, statusBar(), &QStatusBar::showMessage );
     systemTray = new SystemTray(this);
+    quickSwitcher = new QuickSwitcher(this);
+    connect( quickSwitcher, &QuickSwitcher::roomSelected, roomListDock, &RoomListDock::selectRoom );
     createMenu();
     loadSettings();
     statusBar(); // Make sure it is displayed from the start
@@ -95,6 +102,13 @@ void MainWindow::createMenu()
 
     auto joinRoomAction = roomMenu->addAction(tr("&Join Room..."));
     connect( joinRoomAction, &QAction::triggered, [=]{ showJoinRoomDialog(); } );
+
+    auto directoryAction = roomMenu->addAction(tr("&Browse Room Directory..."));
+    connect( directoryAction, &QAction::triggered, [=]{ showRoomDirectory(); } );
+
+    auto switchRoomAction = roomMenu->addAction(tr("&Switch to Room..."));
+    switchRoomAction->setShortcut(Qt::CTRL + Qt::Key_K);
+    connect( switchRoomAction, &QAction::triggered, [=]{ quickSwitcher->popup(); } );
 }
 
 void MainWindow::loadSettings()
@@ -142,10 +156,20 @@ void MainWindow::setConnection(QuaternionConnection* newConnection)
         userListDock->setConnection(nullptr);
         roomListDock->setConnection(nullptr);
         systemTray->setConnection(nullptr);
+        quickSwitcher->setConnection(nullptr);
 
+        // This may be called from a scheduler's signal
+        syncScheduler->stop();
+        syncScheduler->deleteLater();
+        syncScheduler = nullptr;
+        connection->saveState();
         connection->disconnectFromServer();
         connection->disconnect(); // Disconnect everybody from all connection's signals
         connection->deleteLater();
+
+        // Cached avatars refer to users of the old connection
+        AvatarCache::instance()->report();
+        AvatarCache::instance()->clear();
     }
 
     connection = newConnection;
@@ -158,12 +182,16 @@ void MainWindow::setConnection(QuaternionConnection* newConnection)
         userListDock->setConnection(connection);
         roomListDock->setConnection(connection);
         systemTray->setConnection(connection);
+        quickSwitcher->setConnection(connection);
+
+        syncScheduler = new SyncScheduler(connection, this);
+        connect( syncScheduler, &SyncScheduler::connected, this, &MainWindow::gotEvents );
+        connect( syncScheduler, &SyncScheduler::authFailed, this, &MainWindow::sessionExpired );
+        connect( syncScheduler, &SyncScheduler::showStatusMessage, statusBar(), &QStatusBar::showMessage );
 
         using QMatrixClient::Connection;
         connect( connection, &Connection::connectionError, this, &MainWindow::connectionError );
-        connect( connection, &Connection::syncDone, this, &MainWindow::gotEvents );
         connect( connection, &Connection::connected, this, &MainWindow::initialSync );
-        connect( connection, &Connection::reconnected, this, &MainWindow::getNewEvents );
         connect( connection, &Connection::loginError, this, &MainWindow::loggedOut );
         connect( connection, &Connection::loggedOut, [=]{ loggedOut(); } );
     }
@@ -236,13 +264,13 @@ void MainWindow::initialSync()
     setWindowTitle(connection->userId());
     busyLabel->show();
     busyIndicator->start();
-    statusBar()->showMessage("Syncing, please wait...");
-    getNewEvents();
-}
-
-void MainWindow::getNewEvents()
-{
-    connection->sync(30*1000);
+    // The cache may be of any age, so the first sync is a catch-up one
+    const bool restored = connection->loadState();
+    if (restored)
+        statusBar()->showMessage(tr("Restored from the cache, catching up..."));
+    else
+        statusBar()->showMessage("Syncing, please wait...");
+    syncScheduler->start(restored);
 }
 
 void MainWindow::gotEvents()
@@ -253,14 +281,24 @@ void MainWindow::gotEvents()
         busyIndicator->stop();
         statusBar()->showMessage(tr("Connected as %1").arg(connection->userId()), 5000);
     }
-    getNewEvents();
+}
+
+void MainWindow::sessionExpired(const QString& message)
+{
+    QMatrixClient::AccountSettings account { connection->userId() };
+    account.clearAccessToken();
+    account.sync();
+
+    busyLabel->hide();
+    busyIndicator->stop();
+    loggedOut(tr("The session has ended: %1").arg(message));
 }
 
 void MainWindow::connectionError(QString error)
 {
-    qDebug() << error;
-    qDebug() << "reconnecting...";
-    connection->reconnect();
+    // Sync failures are retried by the scheduler; this is about the rest
+    qWarning() << "Connection error:" << error;
+    statusBar()->showMessage(error, 5000);
 }
 
 void MainWindow::closeEvent(QCloseEvent* event)
@@ -270,6 +308,15 @@ void MainWindow::closeEvent(QCloseEvent* event)
     event->accept();
 }
 
+void MainWindow::showRoomDirectory()
+{
+    if( !connection )
+        return;
+
+    RoomDirectoryDialog dialog(connection, this);
+    dialog.exec();
+}
+
 void MainWindow::showJoinRoomDialog()
 {
     bool ok;
@@ -27,6 +27,8 @@ class UserListDock;
 class ChatRoomWidget;
 class QuaternionConnection;
 class SystemTray;
+class QuickSwitcher;
+class SyncScheduler;
 
 class QAction;
 class QMenu;
@@ -53,13 +55,14 @@ class MainWindow: public QMainWindow
     private slots:
         void initialize();
         void initialSync();
-        void getNewEvents();
         void gotEvents();
+        void sessionExpired(const QString& message);
         void loggedOut(const QString& message = QString());
 
         void connectionError(QString error);
 
         void showJoinRoomDialog();
+        void showRoomDirectory();
         void showLoginWindow(const QString& statusMessage = QString());
         void logout();
 
@@ -68,6 +71,7 @@ class MainWindow: public QMainWindow
         UserListDock* userListDock;
         ChatRoomWidget* chatRoomWidget;
         QuaternionConnection* connection;
+        SyncScheduler* syncScheduler;
 
         QMovie* busyIndicator;
         QLabel* busyLabel;
@@ -76,6 +80,7 @@ class MainWindow: public QMainWindow
         QAction* logoutAction;
 
         SystemTray* systemTray;
+        QuickSwitcher* quickSwitcher;
 
         void createMenu();
         void invokeLogin();
@@ -0,0 +1,166 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "membersearchindex.h"
+
+#include <QtCore/QSet>
+#include <QtCore/QRegularExpression>
+
+#include "lib/room.h"
+#include "lib/user.h"
+
+#include <algorithm>
+
+using namespace QMatrixClient;
+
+static QStringList splitWords(const QString& text)
+{
+    static const QRegularExpression separators("[\\s\\p{P}\\p{S}]+");
+    return text.split(separators, QString::SkipEmptyParts);
+}
+
+QString MemberSearchIndex::normalize(const QString& text)
+{
+    return text.normalized(QString::NormalizationForm_KD).toCaseFolded();
+}
+
+MemberSearchIndex::MemberSearchIndex(Room* room)
+    : QObject(room)
+    , m_room(room)
+{
+    const auto users = room->users();
+    m_userTokens.reserve(users.size());
+    for (User* u: users)
+    {
+        QStringList tokens = tokensFor(u);
+        for (const QString& t: tokens)
+        {
+            Token token { t, u };
+            m_tokens.push_back(token);
+        }
+        m_userTokens.insert(u, tokens);
+    }
+    std::sort(m_tokens.begin(), m_tokens.end());
+
+    connect( room, &Room::userAdded, this, &MemberSearchIndex::userAdded );
+    connect( room, &Room::userRemoved, this, &MemberSearchIndex::userRemoved );
+    connect( room, &Room::memberRenamed, this, &MemberSearchIndex::memberRenamed );
+}
+
+QVector<User*> MemberSearchIndex::find(const QString& query) const
+{
+    QStringList words = splitWords(normalize(query));
+    QVector<User*> result;
+    if (words.isEmpty())
+        return result;
+
+    // Look up the longest word, as it's likely to match the fewest tokens,
+    // and check the rest against the tokens of each candidate.
+    auto longest = std::max_element(words.begin(), words.end(),
+        [](const QString& a, const QString& b) { return a.size() < b.size(); });
+    const QString prefix = *longest;
+    words.erase(longest);
+
+    QSet<User*> seen;
+    Token probe { prefix, nullptr };
+    for (int i = lowerBound(probe);
+         i < m_tokens.size() && m_tokens.at(i).text.startsWith(prefix); ++i)
+    {
+        User* u = m_tokens.at(i).user;
+        if (seen.contains(u))
+            continue;
+        seen.insert(u);
+
+        const QStringList& tokens = m_userTokens[u];
+        bool matches = std::all_of(words.begin(), words.end(),
+            [&tokens](const QString& w) {
+                return std::any_of(tokens.begin(), tokens.end(),
+                    [&w](const QString& t) { return t.startsWith(w); });
+            });
+        if (matches)
+            result.push_back(u);
+    }
+    return result;
+}
+
+QStringList MemberSearchIndex::tokensFor(User* user) const
+{
+    QString name = normalize(m_room->roomMembername(user));
+    QStringList tokens = splitWords(name);
+    if (tokens.size() != 1 || tokens.front() != name)
+        tokens.push_back(name);
+    QString id = normalize(user->id());
+    if (id.startsWith('@'))
+        id.remove(0, 1);
+    tokens.push_back(id);
+    tokens.removeDuplicates();
+    return tokens;
+}
+
+int MemberSearchIndex::lowerBound(const Token& probe) const
+{
+    return std::lower_bound(m_tokens.begin(), m_tokens.end(), probe) - m_tokens.begin();
+}
+
+void MemberSearchIndex::insert(User* user)
+{
+    QStringList tokens = tokensFor(user);
+    for (const QString& t: tokens)
+    {
+        Token token { t, user };
+        m_tokens.insert(lowerBound(token), token);
+    }
+    m_userTokens.insert(user, tokens);
+}
+
+void MemberSearchIndex::remove(User* user)
+{
+    auto it = m_userTokens.find(user);
+    if (it == m_userTokens.end())
+        return;
+    for (const QString& t: *it)
+    {
+        Token token { t, user };
+        int pos = lowerBound(token);
+        if (pos < m_tokens.size() && m_tokens.at(pos).user == user)
+            m_tokens.remove(pos);
+    }
+    m_userTokens.erase(it);
+}
+
+void MemberSearchIndex::userAdded(User* user)
+{
+    if (m_userTokens.contains(user))
+        return;
+    insert(user);
+    emit updated();
+}
+
+void MemberSearchIndex::userRemoved(User* user)
+{
+    remove(user);
+    emit updated();
+}
+
+void MemberSearchIndex::memberRenamed(User* user)
+{
+    remove(user);
+    insert(user);
+    emit updated();
+}
@@ -0,0 +1,88 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef MEMBERSEARCHINDEX_H
+#define MEMBERSEARCHINDEX_H
+
+#include <QtCore/QObject>
+#include <QtCore/QVector>
+#include <QtCore/QHash>
+#include <QtCore/QStringList>
+
+namespace QMatrixClient
+{
+    class Room;
+    class User;
+}
+
+/**
+ * Prefix search over the members of a room.
+ *
+ * Every member is indexed under several normalized tokens: the whole
+ * display name, each word of it and the user id without the leading '@'.
+ * The tokens live in one sorted array, so looking up a prefix is a binary
+ * search followed by a scan over the matching tokens only. The index is
+ * updated incrementally as members join, leave or get renamed.
+ */
+class MemberSearchIndex: public QObject
+{
+        Q_OBJECT
+    public:
+        /** Compatibility-decomposed and case-folded form used for matching */
+        static QString normalize(const QString& text);
+
+        explicit MemberSearchIndex(QMatrixClient::Room* room);
+
+        /**
+         * Returns the members matching every word of the query as a prefix
+         * of one of their tokens, in no particular order.
+         */
+        QVector<QMatrixClient::User*> find(const QString& query) const;
+
+    signals:
+        void updated();
+
+    private slots:
+        void userAdded(QMatrixClient::User* user);
+        void userRemoved(QMatrixClient::User* user);
+        void memberRenamed(QMatrixClient::User* user);
+
+    private:
+        struct Token
+        {
+            QString text;
+            QMatrixClient::User* user;
+
+            bool operator<(const Token& other) const
+            {
+                return text < other.text || (text == other.text && user < other.user);
+            }
+        };
+
+        QMatrixClient::Room* m_room;
+        QVector<Token> m_tokens;
+        QHash<QMatrixClient::User*, QStringList> m_userTokens;
+
+        QStringList tokensFor(QMatrixClient::User* user) const;
+        int lowerBound(const Token& probe) const;
+        void insert(QMatrixClient::User* user);
+        void remove(QMatrixClient::User* user);
+};
+
+#endif // MEMBERSEARCHINDEX_H
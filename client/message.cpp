@@ -19,6 +19,9 @@
 
 #include "message.h"
 
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+
 #include "lib/events/event.h"
 #include "lib/events/roommessageevent.h"
 #include "lib/user.h"
@@ -53,9 +56,26 @@ Message::Message(QMatrixClient::Connection* connection,
                     m_isHighlight = true;
             }
         }
+        if (messageEvent->msgtype() == MessageEventType::Image)
+        {
+            // The view sizes the row from this before any of the image loads
+            const QJsonObject info = QJsonDocument::fromJson(event->originalJson().toUtf8())
+                    .object().value("content").toObject().value("info").toObject();
+            m_imageSize = QSize(info.value("w").toInt(), info.value("h").toInt());
+        }
     }
 }
 
+Message::Message(const QString& gapToken, const QDateTime& nextTimestamp)
+    : m_connection(nullptr)
+    , m_event(nullptr)
+    , m_gapToken(gapToken)
+    , m_gapTimestamp(nextTimestamp)
+    , m_isHighlight(false)
+    , m_isStatusMessage(true)
+{
+}
+
 Message::~Message()
 {
 }
@@ -67,7 +87,22 @@ QMatrixClient::Event* Message::messageEvent() const
 
 QDateTime Message::timestamp() const
 {
-    return m_event->timestamp();
+    return m_event ? m_event->timestamp() : m_gapTimestamp;
+}
+
+bool Message::isGap() const
+{
+    return !m_event;
+}
+
+QString Message::gapToken() const
+{
+    return m_gapToken;
+}
+
+void Message::setGapToken(const QString& token)
+{
+    m_gapToken = token;
 }
 
 bool Message::highlight() const
@@ -79,3 +114,8 @@ bool Message::isStatusMessage() const
 {
     return m_isStatusMessage;
 }
+
+QSize Message::imageSize() const
+{
+    return m_imageSize;
+}
@@ -21,6 +21,7 @@
 #define MESSAGE_H
 
 #include <QtCore/QDateTime>
+#include <QtCore/QSize>
 
 namespace QMatrixClient
 {
@@ -35,19 +36,35 @@ class Message
         Message(QMatrixClient::Connection* connection,
                 QMatrixClient::Event* event,
                 QMatrixClient::Room* room);
+        /**
+         * A gap in the timeline: events before the one at nextTimestamp
+         * that were never loaded, to be fetched from the server starting at
+         * gapToken
+         */
+        Message(const QString& gapToken, const QDateTime& nextTimestamp);
         virtual ~Message();
 
+        /** The event; nullptr for a gap */
         QMatrixClient::Event* messageEvent() const;
         QDateTime timestamp() const;
 
+        bool isGap() const;
+        QString gapToken() const;
+        void setGapToken(const QString& token);
+
         bool highlight() const;
         bool isStatusMessage() const;
+        /** Dimensions of an image, as given by the sender; invalid if unknown */
+        QSize imageSize() const;
 
     private:
         QMatrixClient::Connection* m_connection;
         QMatrixClient::Event* m_event;
+        QString m_gapToken;
+        QDateTime m_gapTimestamp;
         bool m_isHighlight;
         bool m_isStatusMessage;
+        QSize m_imageSize;
 };
 
 #endif // MESSAGE_H
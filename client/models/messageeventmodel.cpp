@@ -22,8 +22,12 @@
 #include <QtCore/QStringBuilder>
 #include <QtCore/QSettings>
 #include <QtCore/QDebug>
+#include <QtCore/QUrl>
+#include <QtGui/QDesktopServices>
 
 #include "../message.h"
+#include "../downloadmanager.h"
+#include "../imageprovider.h"
 #include "../quaternionroom.h"
 #include "lib/connection.h"
 #include "lib/room.h"
@@ -46,6 +50,13 @@ enum EventRoles {
     ContentRole,
     ContentTypeRole,
     HighlightRole,
+    ProgressRole,
+    LocalFileRole,
+    PendingRole,
+    FailedRole,
+    PreviewContentRole,
+    ImageSizeRole,
+    GapTokenRole,
 };
 
 QHash<int, QByteArray> MessageEventModel::roleNames() const
@@ -59,6 +70,13 @@ QHash<int, QByteArray> MessageEventModel::roleNames() const
     roles[ContentRole] = "content";
     roles[ContentTypeRole] = "contentType";
     roles[HighlightRole] = "highlight";
+    roles[ProgressRole] = "progress";
+    roles[LocalFileRole] = "localFile";
+    roles[PendingRole] = "pending";
+    roles[FailedRole] = "failed";
+    roles[PreviewContentRole] = "previewContent";
+    roles[ImageSizeRole] = "imageSize";
+    roles[GapTokenRole] = "gapToken";
     return roles;
 }
 
@@ -66,6 +84,7 @@ MessageEventModel::MessageEventModel(QObject* parent)
     : QAbstractListModel(parent)
     , m_connection(nullptr)
     , m_currentRoom(nullptr)
+    , m_downloadManager(nullptr)
 { }
 
 MessageEventModel::~MessageEventModel()
@@ -82,19 +101,35 @@ void MessageEventModel::changeRoom(QuaternionRoom* room)
     if( room )
     {
         using namespace QMatrixClient;
-        connect(m_currentRoom, &QuaternionRoom::aboutToAddNewMessages,
-                [=](const Events& events)
+        // Rows of messages() come first, pending events after them
+        connect(m_currentRoom, &QuaternionRoom::aboutToInsertMessages,
+                [=](int from, int to) { beginInsertRows(QModelIndex(), from, to); });
+        connect(m_currentRoom, &QuaternionRoom::insertedMessages,
+                this, &MessageEventModel::endInsertRows);
+        connect(m_currentRoom, &QuaternionRoom::aboutToRemoveMessages,
+                [=](int from, int to) { beginRemoveRows(QModelIndex(), from, to); });
+        connect(m_currentRoom, &QuaternionRoom::removedMessages,
+                this, &MessageEventModel::endRemoveRows);
+        connect(m_currentRoom, &QuaternionRoom::gapChanged,
+                [=](int i) { emit dataChanged(index(i), index(i), {GapTokenRole}); });
+        connect(m_currentRoom, &QuaternionRoom::pendingEventAboutToAdd,
+                [=] { beginInsertRows(QModelIndex(), rowCount(), rowCount()); });
+        connect(m_currentRoom, &QuaternionRoom::pendingEventAdded,
+                this, &MessageEventModel::endInsertRows);
+        connect(m_currentRoom, &QuaternionRoom::pendingEventChanged,
+                [=](int i)
                 {
-                    beginInsertRows(QModelIndex(),
-                                    rowCount(), rowCount() + events.size() - 1);
+                    int row = m_currentRoom->messages().count() + i;
+                    emit dataChanged(index(row), index(row));
                 });
-        connect(m_currentRoom, &QuaternionRoom::aboutToAddHistoricalMessages,
-                [=](const Events& events)
+        connect(m_currentRoom, &QuaternionRoom::pendingEventAboutToRemove,
+                [=](int i)
                 {
-                    beginInsertRows(QModelIndex(), 0, events.size() - 1);
+                    int row = m_currentRoom->messages().count() + i;
+                    beginRemoveRows(QModelIndex(), row, row);
                 });
-        connect(m_currentRoom, &QuaternionRoom::addedMessages,
-                this, &MessageEventModel::endInsertRows);
+        connect(m_currentRoom, &QuaternionRoom::pendingEventRemoved,
+                this, &MessageEventModel::endRemoveRows);
         connect(m_currentRoom, &QuaternionRoom::lastReadEventChanged,
                 [=](const User* u) {
                     if (u == m_connection->user())
@@ -111,21 +146,125 @@ void MessageEventModel::setConnection(QMatrixClient::Connection* connection)
     m_connection = connection;
 }
 
+void MessageEventModel::setDownloadManager(DownloadManager* manager)
+{
+    if (m_downloadManager)
+        m_downloadManager->disconnect(this);
+    m_downloadManager = manager;
+    if (m_downloadManager)
+    {
+        connect( m_downloadManager, &DownloadManager::progressChanged,
+                 this, &MessageEventModel::downloadChanged );
+        connect( m_downloadManager, &DownloadManager::stateChanged,
+                 this, &MessageEventModel::downloadChanged );
+    }
+}
+
+void MessageEventModel::downloadFile(int row)
+{
+    using namespace QMatrixClient;
+    if (!m_downloadManager || !m_currentRoom ||
+            row < 0 || row >= m_currentRoom->messages().count())
+        return;
+
+    Event* event = m_currentRoom->messages().at(row)->messageEvent();
+    if (!event || event->type() != EventType::RoomMessage)
+        return;
+    auto e = static_cast<RoomMessageEvent*>(event);
+    switch (e->msgtype())
+    {
+        case MessageEventType::File:
+        case MessageEventType::Video:
+        case MessageEventType::Audio:
+        {
+            auto fileInfo = static_cast<MessageEventContent::FileInfo*>(e->content());
+            if (fileInfo)
+                m_downloadManager->download(e->id(), fileInfo->url, e->body());
+            break;
+        }
+        default:
+            qDebug() << "Event" << e->id() << "has nothing to download";
+    }
+}
+
+void MessageEventModel::openFile(int row)
+{
+    QString localFile = data(index(row), LocalFileRole).toString();
+    if (!localFile.isEmpty())
+        QDesktopServices::openUrl(QUrl::fromLocalFile(localFile));
+}
+
+void MessageEventModel::fillGap(int row)
+{
+    if (m_currentRoom && row >= 0 && row < m_currentRoom->messages().count())
+        m_currentRoom->fillGap(row);
+}
+
+QString MessageEventModel::pendingTxnId(int row) const
+{
+    if (!m_currentRoom)
+        return QString();
+    const int pendingIndex = row - m_currentRoom->messages().count();
+    if (pendingIndex < 0 || pendingIndex >= m_currentRoom->pendingEvents().count())
+        return QString();
+    return m_currentRoom->pendingEvents().at(pendingIndex).txnId;
+}
+
+void MessageEventModel::retryPending(int row)
+{
+    const QString txnId = pendingTxnId(row);
+    if (!txnId.isEmpty())
+        m_currentRoom->retryPendingEvent(txnId);
+}
+
+void MessageEventModel::discardPending(int row)
+{
+    const QString txnId = pendingTxnId(row);
+    if (!txnId.isEmpty())
+        m_currentRoom->discardPendingEvent(txnId);
+}
+
+void MessageEventModel::downloadChanged(const QString& eventId)
+{
+    int row = findRow(eventId);
+    if (row != -1)
+        emit dataChanged(index(row), index(row), {ProgressRole, LocalFileRole});
+}
+
+int MessageEventModel::findRow(const QString& eventId) const
+{
+    if (!m_currentRoom)
+        return -1;
+    // Downloads are usually started for recent messages, so look from the end
+    const auto& messages = m_currentRoom->messages();
+    for (int row = messages.size() - 1; row >= 0; --row)
+        if (!messages.at(row)->isGap() && messages.at(row)->messageEvent()->id() == eventId)
+            return row;
+    return -1;
+}
+
 int MessageEventModel::rowCount(const QModelIndex& parent) const
 {
     if( !m_currentRoom || parent.isValid() )
         return 0;
-    return m_currentRoom->messages().count();
+    return m_currentRoom->messages().count() + m_currentRoom->pendingEvents().count();
 }
 
 QVariant MessageEventModel::data(const QModelIndex& index, int role) const
 {
     using namespace QMatrixClient;
     if( !m_connection || !m_currentRoom ||
-            index.row() < 0 || index.row() >= m_currentRoom->messages().count())
+            index.row() < 0 || index.row() >= rowCount())
         return QVariant();
 
+    if( index.row() >= m_currentRoom->messages().count() )
+        return pendingData(m_currentRoom->pendingEvents()
+                .at(index.row() - m_currentRoom->messages().count()), role);
+
     const Message* message = m_currentRoom->messages().at(index.row());;
+    if( message->isGap() )
+        return gapData(message, role);
+
     Event* event = message->messageEvent();
     // FIXME: Rewind to the name that was at the time of this event
     QString senderName = m_currentRoom->roomMembername(event->senderId());
@@ -179,6 +318,10 @@ QVariant MessageEventModel::data(const QModelIndex& index, int role) const
                     return "image";
                 else if( msgType == MessageEventType::Emote )
                     return "emote";
+                else if( msgType == MessageEventType::File ||
+                         msgType == MessageEventType::Video ||
+                         msgType == MessageEventType::Audio )
+                    return "file";
                 return "message";
             }
             case EventType::RoomMember:
@@ -255,7 +398,7 @@ QVariant MessageEventModel::data(const QModelIndex& index, int role) const
                 {
                     auto fileInfo = static_cast<FileInfo*>(e->content());
                     if (role == ContentRole)
-                        return e->body(); // TODO
+                        return e->body();
                     else
                         return fileInfo ? fileInfo->mimetype.name() : "unknown";
                 }
@@ -332,9 +475,132 @@ QVariant MessageEventModel::data(const QModelIndex& index, int role) const
         return event->id();
     }
 
+    if( role == ImageSizeRole )
+    {
+        if (message->imageSize().isValid() && !message->imageSize().isEmpty())
+            return message->imageSize();
+        return QVariant();
+    }
+
+    if( role == PreviewContentRole )
+    {
+        if( event->type() == EventType::RoomMessage )
+        {
+            auto e = static_cast<RoomMessageEvent*>(event);
+            if( e->msgtype() == MessageEventType::Image )
+            {
+                auto content = static_cast<MessageEventContent::ImageContent*>(e->content());
+                return QUrl("image://mtx/" + ImageProvider::PreviewPrefix +
+                            content->url.host() + content->url.path());
+            }
+        }
+        return QVariant();
+    }
+
+    if( role == ProgressRole || role == LocalFileRole )
+    {
+        if (!m_downloadManager)
+            return QVariant();
+        if (role == ProgressRole)
+        {
+            switch (m_downloadManager->state(event->id()))
+            {
+                case DownloadManager::NotStarted:
+                case DownloadManager::Failed:
+                    return QVariant();
+                case DownloadManager::Finished:
+                    return 1.0;
+                default:
+                    return m_downloadManager->progress(event->id());
+            }
+        }
+        return m_downloadManager->localFile(event->id());
+    }
+
     return QVariant();
 }
 
+QVariant MessageEventModel::pendingData(const PendingEvent& pending, int role) const
+{
+    switch (role)
+    {
+        case Qt::DisplayRole:
+            return pending.body;
+        case EventTypeRole:
+            if (pending.msgType == "m.image")
+                return "image";
+            if (pending.msgType == "m.emote")
+                return "emote";
+            return "message";
+        case TimeRole:
+            return pending.timestamp;
+        case DateRole:
+            return pending.timestamp.toLocalTime().date();
+        case AuthorRole:
+            return m_currentRoom->roomMembername(m_connection->user());
+        case ContentRole:
+            if (pending.msgType == "m.image")
+                return QUrl::fromLocalFile(pending.localFile);
+            return pending.body;
+        case ContentTypeRole:
+            return "text/plain";
+        case ProgressRole:
+            if (pending.progress < 0)
+                return QVariant();
+            return pending.progress;
+        case FailedRole:
+            return pending.status == PendingEvent::Failed;
+        case Qt::ToolTipRole:
+        case PendingRole:
+            switch (pending.status)
+            {
+                case PendingEvent::Queued:
+                    return tr("Queued");
+                case PendingEvent::Preparing:
+                    return tr("Preparing");
+                case PendingEvent::Uploading:
+                    return tr("Uploading");
+                case PendingEvent::Sending:
+                    return tr("Sending");
+                case PendingEvent::Sent:
+                    return tr("Sent");
+                case PendingEvent::Failed:
+                    return tr("Failed");
+            }
+            return QVariant();
+        default:
+            return QVariant();
+    }
+}
+
+QVariant MessageEventModel::gapData(const Message* gap, int role) const
+{
+    switch (role)
+    {
+        case Qt::DisplayRole:
+        case ContentRole:
+            return tr("Loading missed messages...");
+        case EventTypeRole:
+            return "gap";
+        case TimeRole:
+            return gap->timestamp();
+        case DateRole:
+            return gap->timestamp().toLocalTime().date();
+        case ContentTypeRole:
+            return "text/plain";
+        case GapTokenRole:
+            return gap->gapToken();
+        case HighlightRole:
+            return false;
+        case Qt::ToolTipRole:
+        case EventIdRole:
+        case LocalFileRole:
+            return QString();
+        default:
+            return QVariant();
+    }
+}
+
 QString MessageEventModel::lastReadId() const
 {
     if (m_currentRoom)
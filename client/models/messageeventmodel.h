@@ -26,6 +26,7 @@
 #include <QtCore/QModelIndex>
 
 class Message;
+class DownloadManager;
 
 class MessageEventModel: public QAbstractListModel
 {
@@ -36,6 +37,7 @@ class MessageEventModel: public QAbstractListModel
         virtual ~MessageEventModel();
 
         void setConnection(QMatrixClient::Connection* connection);
+        void setDownloadManager(DownloadManager* manager);
         void changeRoom(QuaternionRoom* room);
 
         //override QModelIndex index(int row, int column, const QModelIndex& parent=QModelIndex()) const;
@@ -46,12 +48,29 @@ class MessageEventModel: public QAbstractListModel
 
         QString lastReadId() const;
 
+        Q_INVOKABLE void downloadFile(int row);
+        Q_INVOKABLE void openFile(int row);
+        /** Called by the view when a gap row comes into sight */
+        Q_INVOKABLE void fillGap(int row);
+        /** Actions on a pending event that has failed to send */
+        Q_INVOKABLE void retryPending(int row);
+        Q_INVOKABLE void discardPending(int row);
+
     signals:
         void lastReadIdChanged();
 
+    private slots:
+        void downloadChanged(const QString& eventId);
+
     private:
         QMatrixClient::Connection* m_connection;
         QuaternionRoom* m_currentRoom;
+        DownloadManager* m_downloadManager;
+
+        int findRow(const QString& eventId) const;
+        QString pendingTxnId(int row) const;
+        QVariant pendingData(const PendingEvent& pending, int role) const;
+        QVariant gapData(const Message* gap, int role) const;
 };
 
 #endif // LOGMESSAGEMODEL_H
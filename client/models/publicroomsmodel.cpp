@@ -0,0 +1,283 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "publicroomsmodel.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QSettings>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QJsonArray>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+#include "../quaternionconnection.h"
+
+#include <algorithm>
+
+PublicRoomsModel::PublicRoomsModel(QuaternionConnection* connection, QObject* parent)
+    : QAbstractListModel(parent)
+    , m_connection(connection)
+    , m_atEnd(false)
+    , m_rowCount(0)
+    , m_totalEstimate(-1)
+{
+    QSettings settings;
+    m_pageSize = qMax(10, settings.value("Directory/page_size", 100).toInt());
+    m_pages.setMaxCost(qMax(2, settings.value("Directory/cached_pages", 10).toInt()));
+    m_missingPagesTimer.setSingleShot(true);
+    m_missingPagesTimer.setInterval(0);
+    connect( &m_missingPagesTimer, &QTimer::timeout,
+             this, &PublicRoomsModel::requestMissingPages );
+}
+
+PublicRoomsModel::~PublicRoomsModel()
+{
+    abortRequests();
+}
+
+void PublicRoomsModel::setSearchTerm(const QString& searchTerm)
+{
+    QString term = searchTerm.trimmed();
+    if (term == m_searchTerm && (m_rowCount > 0 || !m_requests.isEmpty()))
+        return;
+
+    abortRequests();
+    beginResetModel();
+    m_searchTerm = term;
+    m_pageTokens.clear();
+    m_pageStarts.clear();
+    m_nextBatch.clear();
+    m_atEnd = false;
+    m_rowCount = 0;
+    m_pages.clear();
+    m_missingPages.clear();
+    endResetModel();
+    if (m_totalEstimate != -1)
+    {
+        m_totalEstimate = -1;
+        emit totalEstimateChanged(m_totalEstimate);
+    }
+    fetchMore(QModelIndex());
+}
+
+int PublicRoomsModel::totalEstimate() const
+{
+    return m_totalEstimate;
+}
+
+int PublicRoomsModel::rowCount(const QModelIndex& parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return m_rowCount;
+}
+
+bool PublicRoomsModel::canFetchMore(const QModelIndex& parent) const
+{
+    return !parent.isValid() && !m_atEnd
+           && !m_requests.values().contains(m_pageTokens.size());
+}
+
+void PublicRoomsModel::fetchMore(const QModelIndex& parent)
+{
+    if (canFetchMore(parent))
+        requestPage(m_pageTokens.size());
+}
+
+int PublicRoomsModel::pageOf(int row) const
+{
+    return std::upper_bound(m_pageStarts.begin(), m_pageStarts.end(), row)
+           - m_pageStarts.begin() - 1;
+}
+
+QVariant PublicRoomsModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_rowCount)
+        return QVariant();
+
+    const int page = pageOf(index.row());
+    const Page* entries = m_pages.object(page);
+    if (!entries)
+    {
+        // Fell out of the window; ask for it again (not from within a
+        // const call that the view may be making while painting) and
+        // show a placeholder meanwhile
+        m_missingPages.insert(page);
+        m_missingPagesTimer.start();
+        return role == Qt::DisplayRole ? QVariant(tr("Loading...")) : QVariant();
+    }
+    const int offset = index.row() - m_pageStarts.at(page);
+    if (offset >= entries->size())
+        return QVariant();
+    const Entry& e = entries->at(offset);
+    if (e.roomId.isEmpty())
+        return QVariant(); // The page got shorter since it was first loaded
+    switch (role)
+    {
+        case Qt::DisplayRole:
+        {
+            QString name = !e.name.isEmpty() ? e.name
+                         : !e.alias.isEmpty() ? e.alias : e.roomId;
+            return tr("%1 (%2)").arg(name).arg(e.memberCount);
+        }
+        case Qt::ToolTipRole:
+            return e.topic.isEmpty() ? (e.alias.isEmpty() ? e.roomId : e.alias)
+                                     : e.topic;
+        case RoomIdRole:
+            return e.roomId;
+        case AliasRole:
+            return e.alias;
+        case TopicRole:
+            return e.topic;
+        case MemberCountRole:
+            return e.memberCount;
+    }
+    return QVariant();
+}
+
+void PublicRoomsModel::requestMissingPages()
+{
+    const QSet<int> pages = m_missingPages;
+    m_missingPages.clear();
+    for (int page: pages)
+        if (page < m_pageTokens.size() && !m_pages.contains(page))
+            requestPage(page);
+}
+
+void PublicRoomsModel::requestPage(int page)
+{
+    if (!m_connection || m_requests.values().contains(page))
+        return;
+
+    const QString since = page < m_pageTokens.size() ? m_pageTokens.at(page) : m_nextBatch;
+    QJsonObject body;
+    body.insert("limit", m_pageSize);
+    if (!since.isEmpty())
+        body.insert("since", since);
+    if (!m_searchTerm.isEmpty())
+    {
+        QJsonObject filter;
+        filter.insert("generic_search_term", m_searchTerm);
+        body.insert("filter", filter);
+    }
+    // POST is needed for the search filter; it works without it as well
+    QNetworkReply* reply = m_connection->nam()->post(
+        m_connection->makeRequest("/_matrix/client/r0/publicRooms"),
+        QJsonDocument(body).toJson(QJsonDocument::Compact));
+    const bool wasLoading = !m_requests.isEmpty();
+    m_requests.insert(reply, page);
+    connect( reply, &QNetworkReply::finished, this, [=] { pageReceived(reply); } );
+    if (!wasLoading)
+        emit loadingChanged(true);
+}
+
+void PublicRoomsModel::pageReceived(QNetworkReply* reply)
+{
+    reply->deleteLater();
+    auto it = m_requests.find(reply);
+    if (it == m_requests.end())
+        return; // Aborted
+    const int page = *it;
+    m_requests.erase(it);
+    if (m_requests.isEmpty())
+        emit loadingChanged(false);
+
+    if (reply->error() != QNetworkReply::NoError)
+    {
+        qWarning() << "Couldn't load the room directory:" << reply->errorString();
+        emit error(reply->errorString());
+        return;
+    }
+
+    const QJsonObject json = QJsonDocument::fromJson(reply->readAll()).object();
+    const QJsonArray chunk = json.value("chunk").toArray();
+    Page* entries = new Page();
+    entries->reserve(chunk.size());
+    for (const QJsonValue& v: chunk)
+        entries->push_back(parseEntry(v.toObject()));
+
+    if (json.contains("total_room_count_estimate"))
+    {
+        int estimate = json.value("total_room_count_estimate").toInt();
+        if (estimate != m_totalEstimate)
+        {
+            m_totalEstimate = estimate;
+            emit totalEstimateChanged(m_totalEstimate);
+        }
+    }
+
+    if (page == m_pageTokens.size())
+    {
+        // A new page at the end
+        m_pageTokens.push_back(m_nextBatch);
+        m_pageStarts.push_back(m_rowCount);
+        m_nextBatch = json.value("next_batch").toString();
+        m_atEnd = m_nextBatch.isEmpty() || entries->isEmpty();
+        if (!entries->isEmpty())
+        {
+            beginInsertRows(QModelIndex(), m_rowCount, m_rowCount + entries->size() - 1);
+            m_rowCount += entries->size();
+            m_pages.insert(page, entries, 1);
+            endInsertRows();
+        }
+        else
+        {
+            m_pages.insert(page, entries, 1);
+        }
+        return;
+    }
+
+    // A page that was evicted before. The directory may have changed on
+    // the server in the meantime, but the rows have to stay where they are.
+    const int first = m_pageStarts.at(page);
+    const int last = page + 1 < m_pageStarts.size() ? m_pageStarts.at(page + 1) - 1
+                                                    : m_rowCount - 1;
+    entries->resize(last - first + 1);
+    m_pages.insert(page, entries, 1);
+    emit dataChanged(index(first), index(last));
+}
+
+void PublicRoomsModel::abortRequests()
+{
+    auto requests = m_requests.keys();
+    const bool wasLoading = !m_requests.isEmpty();
+    m_requests.clear();
+    for (QNetworkReply* reply: requests)
+        reply->abort();
+    if (wasLoading)
+        emit loadingChanged(false);
+}
+
+PublicRoomsModel::Entry PublicRoomsModel::parseEntry(const QJsonObject& json)
+{
+    Entry e;
+    e.roomId = json.value("room_id").toString();
+    e.name = json.value("name").toString();
+    e.alias = json.value("canonical_alias").toString();
+    if (e.alias.isEmpty())
+    {
+        const QJsonArray aliases = json.value("aliases").toArray();
+        if (!aliases.isEmpty())
+            e.alias = aliases.first().toString();
+    }
+    e.topic = json.value("topic").toString();
+    e.memberCount = json.value("num_joined_members").toInt();
+    return e;
+}
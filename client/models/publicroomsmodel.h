@@ -0,0 +1,109 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef PUBLICROOMSMODEL_H
+#define PUBLICROOMSMODEL_H
+
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+class QuaternionConnection;
+class QNetworkReply;
+class QJsonObject;
+
+/**
+ * The public room directory of the homeserver.
+ *
+ * Pages are requested from /publicRooms as the view asks for more rows
+ * (canFetchMore()/fetchMore()), optionally narrowed with a server-side
+ * search term. Only a window of recently used pages is kept in memory
+ * ("Directory/cached_pages"); for the rest, just the pagination token is
+ * remembered and the page is requested again when its rows are shown.
+ */
+class PublicRoomsModel: public QAbstractListModel
+{
+        Q_OBJECT
+    public:
+        enum Roles {
+            RoomIdRole = Qt::UserRole + 1,
+            AliasRole,
+            TopicRole,
+            MemberCountRole,
+        };
+
+        PublicRoomsModel(QuaternionConnection* connection, QObject* parent = nullptr);
+        virtual ~PublicRoomsModel();
+
+        void setSearchTerm(const QString& searchTerm);
+        /** Server's estimate of the number of rooms, or -1 if unknown */
+        int totalEstimate() const;
+
+        QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+        int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+        bool canFetchMore(const QModelIndex& parent) const override;
+        void fetchMore(const QModelIndex& parent) override;
+
+    signals:
+        void totalEstimateChanged(int estimate);
+        void loadingChanged(bool loading);
+        void error(const QString& message);
+
+    private slots:
+        void requestMissingPages();
+
+    private:
+        struct Entry
+        {
+            QString roomId;
+            QString name;
+            QString alias;
+            QString topic;
+            int memberCount;
+        };
+        using Page = QVector<Entry>;
+
+        QuaternionConnection* m_connection;
+        QString m_searchTerm;
+        int m_pageSize;
+        /** Token to request each page with; the first one is empty */
+        QVector<QString> m_pageTokens;
+        /** First row of each page */
+        QVector<int> m_pageStarts;
+        QString m_nextBatch;
+        bool m_atEnd;
+        int m_rowCount;
+        int m_totalEstimate;
+        mutable QCache<int, Page> m_pages;
+        QHash<QNetworkReply*, int> m_requests;
+        /** Evicted pages that data() was asked for; requested after it returns */
+        mutable QSet<int> m_missingPages;
+        mutable QTimer m_missingPagesTimer;
+
+        int pageOf(int row) const;
+        void requestPage(int page);
+        void pageReceived(QNetworkReply* reply);
+        void abortRequests();
+        static Entry parseEntry(const QJsonObject& json);
+};
+
+#endif // PUBLICROOMSMODEL_H
@@ -24,15 +24,23 @@
 #include <QtGui/QIcon>
 
 #include <QtCore/QDebug>
+#include <QtCore/QSettings>
 
 #include "lib/connection.h"
 #include "lib/room.h"
 #include "../quaternionroom.h"
 
+#include <algorithm>
+
 RoomListModel::RoomListModel(QObject* parent)
     : QAbstractListModel(parent)
 {
     m_connection = nullptr;
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(0);
+    connect( &m_flushTimer, &QTimer::timeout, this, &RoomListModel::flushChanges );
+    m_order = QSettings().value("UI/room_order").toString() == "unread"
+              ? UnreadOrder : ActivityOrder;
 }
 
 RoomListModel::~RoomListModel()
@@ -49,13 +57,27 @@ void RoomListModel::setConnection(QMatrixClient::Connection* connection)
         room->disconnect( this );
 
     m_rooms.clear();
+    m_rows.clear();
+    m_keys.clear();
+    m_changes.clear();
+    m_rowData.clear();
+    m_flushTimer.stop();
 
     m_connection = connection;
     if (m_connection)
     {
         connect( m_connection, &QMatrixClient::Connection::newRoom, this, &RoomListModel::addRoom );
+        m_rooms.reserve(m_connection->roomMap().size());
         for( QMatrixClient::Room* r: m_connection->roomMap() )
+        {
             doAddRoom(r);
+            m_rooms.append(static_cast<QuaternionRoom*>(r));
+        }
+        std::sort(m_rooms.begin(), m_rooms.end(),
+            [this](QuaternionRoom* a, QuaternionRoom* b) {
+                return lessThan(*m_keys.constFind(a), *m_keys.constFind(b));
+            });
+        updateRows(0, m_rooms.count() - 1);
     }
 
     endResetModel();
@@ -66,23 +88,122 @@ QuaternionRoom* RoomListModel::roomAt(int row)
     return m_rooms.at(row);
 }
 
-void RoomListModel::addRoom(QMatrixClient::Room* room)
+int RoomListModel::rowOf(QuaternionRoom* room) const
+{
+    return m_rows.value(room, -1);
+}
+
+RoomListModel::Order RoomListModel::order() const
 {
-    beginInsertRows(QModelIndex(), m_rooms.count(), m_rooms.count());
+    return m_order;
+}
+
+void RoomListModel::setOrder(RoomListModel::Order order)
+{
+    if (m_order == order)
+        return;
+
+    QSettings().setValue("UI/room_order", order == UnreadOrder ? "unread" : "activity");
+    // Changing the order is rare enough to justify a full resort
+    beginResetModel();
+    m_order = order;
+    std::sort(m_rooms.begin(), m_rooms.end(),
+        [this](QuaternionRoom* a, QuaternionRoom* b) {
+            return lessThan(*m_keys.constFind(a), *m_keys.constFind(b));
+        });
+    updateRows(0, m_rooms.count() - 1);
+    endResetModel();
+}
+
+void RoomListModel::addRoom(QMatrixClient::Room* r)
+{
+    QuaternionRoom* room = static_cast<QuaternionRoom*>(r);
+    if (m_rows.contains(room))
+        return;
+    SortKey key = sortKey(room);
+    int pos = lowerBound(key);
+    beginInsertRows(QModelIndex(), pos, pos);
     doAddRoom(room);
+    m_rooms.insert(pos, room);
+    updateRows(pos, m_rooms.count() - 1);
     endInsertRows();
 }
 
 void RoomListModel::doAddRoom(QMatrixClient::Room* r)
 {
     QuaternionRoom* room = static_cast<QuaternionRoom*>(r);
-    m_rooms.append(room);
+    m_keys.insert(room, sortKey(room));
     connect( room, &QuaternionRoom::displaynameChanged,
         this, &RoomListModel::displaynameChanged );
     connect( room, &QuaternionRoom::unreadMessagesChanged,
         this, &RoomListModel::unreadMessagesChanged );
-    connect( room, &QuaternionRoom::notificationCountChanged,
-        this, &RoomListModel::unreadMessagesChanged );
+    connect( room, &QuaternionRoom::highlightCountChanged,
+        this, &RoomListModel::highlightCountChanged );
+    connect( room, &QuaternionRoom::lastActivityChanged,
+        this, &RoomListModel::activityChanged );
+}
+
+RoomListModel::SortKey RoomListModel::sortKey(QuaternionRoom* room) const
+{
+    SortKey key { room->highlightCount() > 0, room->hasUnreadMessages(),
+                  room->lastActivity(), room->displayName().toCaseFolded(),
+                  room->id() };
+    return key;
+}
+
+bool RoomListModel::lessThan(const SortKey& a, const SortKey& b) const
+{
+    if (m_order == UnreadOrder)
+    {
+        if (a.highlighted != b.highlighted)
+            return a.highlighted;
+        if (a.unread != b.unread)
+            return a.unread;
+    }
+    // An invalid QDateTime compares less than any valid one, so rooms
+    // without messages end up at the bottom
+    if (a.lastActivity != b.lastActivity)
+        return a.lastActivity > b.lastActivity;
+    if (a.name != b.name)
+        return a.name < b.name;
+    return a.id < b.id;
+}
+
+int RoomListModel::lowerBound(const SortKey& key) const
+{
+    return std::lower_bound(m_rooms.begin(), m_rooms.end(), key,
+        [this](QuaternionRoom* r, const SortKey& k) {
+            return lessThan(*m_keys.constFind(r), k);
+        }) - m_rooms.begin();
+}
+
+void RoomListModel::updateRows(int from, int to)
+{
+    for (int i = from; i <= to; ++i)
+        m_rows.insert(m_rooms.at(i), i);
+}
+
+void RoomListModel::reposition(QuaternionRoom* room)
+{
+    int from = rowOf(room);
+    if (from == -1)
+        return;
+
+    // Other rooms still have consistent keys, so the new place can be
+    // looked up before replacing the key of this one
+    SortKey key = sortKey(room);
+    int to = lowerBound(key);
+    if (to > from)
+        --to; // As if the room were already taken out
+    m_keys.insert(room, key);
+    if (to == from)
+        return;
+
+    beginMoveRows(QModelIndex(), from, from, QModelIndex(), to > from ? to + 1 : to);
+    m_rooms.remove(from);
+    m_rooms.insert(to, room);
+    updateRows(qMin(from, to), qMax(from, to));
+    endMoveRows();
 }
 
 int RoomListModel::rowCount(const QModelIndex& parent) const
@@ -102,50 +223,143 @@ QVariant RoomListModel::data(const QModelIndex& index, int role) const
         qDebug() << "UserListModel: something wrong here...";
         return QVariant();
     }
-    QuaternionRoom* room = m_rooms.at(index.row());
+    const RowData& row = rowData(m_rooms.at(index.row()));
     if( role == Qt::DisplayRole )
     {
-        return room->displayName();
+        return row.name;
     }
     if( role == HasUnreadRole )
-        return room->hasUnreadMessages();
+        return row.unread;
     if( role == HighlightCountRole )
-        return room->highlightCount();
+        return row.highlightCount;
+    if( role == RowFlagsRole )
+        return (row.unread ? UnreadFlag : 0) | (row.highlightCount > 0 ? HighlightedFlag : 0);
     if( role == Qt::DecorationRole )
-    {
-        switch( room->joinState() )
-        {
-            case QMatrixClient::JoinState::Join:
-                return QIcon(":/irc-channel-joined.svg");
-            case QMatrixClient::JoinState::Invite:
-                return QIcon(":/irc-channel-invited.svg");
-            case QMatrixClient::JoinState::Leave:
-                return QIcon(":/irc-channel-parted.svg");
-        }
-    }
+        return joinStateIcon(row.joinState);
     if( role == Qt::ToolTipRole )
+        return row.toolTip;
+    return QVariant();
+}
+
+const RoomListModel::RowData& RoomListModel::rowData(QuaternionRoom* room) const
+{
+    auto it = m_rowData.find(room);
+    // The join state has no change signal to listen to, but is cheap to check
+    if( it != m_rowData.end() && it->joinState == int(room->joinState()) )
+        return *it;
+
+    RowData data;
+    data.name = room->displayName();
+    data.joinState = int(room->joinState());
+    data.unread = room->hasUnreadMessages();
+    data.highlightCount = room->highlightCount();
+    data.toolTip = QString("<b>%1</b><br>").arg(data.name);
+    data.toolTip += tr("Room ID: %1<br>").arg(room->id());
+    if( room->joinState() == QMatrixClient::JoinState::Join )
+        data.toolTip += tr("You joined this room");
+    else if( room->joinState() == QMatrixClient::JoinState::Leave )
+        data.toolTip += tr("You left this room");
+    else
+        data.toolTip += tr("You were invited into this room");
+    if( !room->lastMessageSummary().isEmpty() )
+        data.toolTip += "<br>" + room->lastMessageSummary().toHtmlEscaped();
+    return *m_rowData.insert(room, data);
+}
+
+QIcon RoomListModel::joinStateIcon(int joinState)
+{
+    // Copies of a QIcon share its engine, which keeps the SVG rendered
+    // at each requested size, so every icon is rasterized once per size
+    static const QIcon joinedIcon(":/irc-channel-joined.svg");
+    static const QIcon invitedIcon(":/irc-channel-invited.svg");
+    static const QIcon partedIcon(":/irc-channel-parted.svg");
+    switch( QMatrixClient::JoinState(joinState) )
     {
-        QString result = QString("<b>%1</b><br>").arg(room->displayName());
-        result += tr("Room ID: %1<br>").arg(room->id());
-        if( room->joinState() == QMatrixClient::JoinState::Join )
-            result += tr("You joined this room");
-        else if( room->joinState() == QMatrixClient::JoinState::Leave )
-            result += tr("You left this room");
-        else
-            result += tr("You were invited into this room");
-        return result;
+        case QMatrixClient::JoinState::Join:
+            return joinedIcon;
+        case QMatrixClient::JoinState::Invite:
+            return invitedIcon;
+        case QMatrixClient::JoinState::Leave:
+            return partedIcon;
     }
-    return QVariant();
+    return QIcon();
 }
 
 void RoomListModel::displaynameChanged(QMatrixClient::Room* room)
 {
-    int row = m_rooms.indexOf(static_cast<QuaternionRoom*>(room));
-    emit dataChanged(index(row), index(row));
+    markChanged(room, NameChange);
 }
 
 void RoomListModel::unreadMessagesChanged(QMatrixClient::Room* room)
 {
-    int row = m_rooms.indexOf(static_cast<QuaternionRoom*>(room));
-    emit dataChanged(index(row), index(row));
+    markChanged(room, UnreadChange);
+}
+
+void RoomListModel::highlightCountChanged(QMatrixClient::Room* room)
+{
+    markChanged(room, HighlightChange);
+}
+
+void RoomListModel::activityChanged(QuaternionRoom* room)
+{
+    markChanged(room, ActivityChange);
+}
+
+void RoomListModel::markChanged(QMatrixClient::Room* room, RoomListModel::Change change)
+{
+    QuaternionRoom* r = static_cast<QuaternionRoom*>(room);
+    m_changes[r] |= change;
+    m_rowData.remove(r);
+    if (!m_flushTimer.isActive())
+        m_flushTimer.start();
+}
+
+QVector<int> RoomListModel::rolesFor(int changes)
+{
+    QVector<int> roles;
+    if (changes & NameChange)
+        roles << Qt::DisplayRole << Qt::ToolTipRole;
+    if (changes & UnreadChange)
+        roles << HasUnreadRole;
+    if (changes & HighlightChange)
+        roles << HighlightCountRole;
+    // The delegate paints from RowFlagsRole, which both of these change
+    if (changes & (UnreadChange | HighlightChange))
+        roles << RowFlagsRole;
+    if ((changes & ActivityChange) && !(changes & NameChange))
+        roles << Qt::ToolTipRole; // Shows the latest message
+    return roles;
+}
+
+void RoomListModel::flushChanges()
+{
+    // Move the rooms into place first, so that the rows are final
+    for (auto it = m_changes.begin(); it != m_changes.end(); ++it)
+        reposition(it.key());
+
+    QVector< QPair<int, int> > changedRows; // Row and its changes
+    changedRows.reserve(m_changes.size());
+    for (auto it = m_changes.begin(); it != m_changes.end(); ++it)
+    {
+        int row = rowOf(it.key());
+        int changes = it.value();
+        if (row != -1 && changes != 0)
+            changedRows.push_back(qMakePair(row, changes));
+    }
+    m_changes.clear();
+    std::sort(changedRows.begin(), changedRows.end());
+
+    // Adjacent rows with the same kind of changes go in one range
+    for (int begin = 0; begin < changedRows.size(); )
+    {
+        int end = begin + 1;
+        while (end < changedRows.size()
+               && changedRows.at(end).first == changedRows.at(end - 1).first + 1
+               && changedRows.at(end).second == changedRows.at(begin).second)
+            ++end;
+        emit dataChanged(index(changedRows.at(begin).first),
+                         index(changedRows.at(end - 1).first),
+                         rolesFor(changedRows.at(begin).second));
+        begin = end;
+    }
 }
@@ -21,6 +21,11 @@
 #define ROOMLISTMODEL_H
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtCore/QTimer>
+#include <QtGui/QIcon>
 
 namespace QMatrixClient
 {
@@ -30,6 +35,17 @@ namespace QMatrixClient
 
 class QuaternionRoom;
 
+/**
+ * Rooms of the connection, kept sorted by the selected order.
+ *
+ * Each room has a cached sort key and a row in a hash index. When a room
+ * changes, only that room is repositioned (with a row move) instead of
+ * sorting the whole list again.
+ *
+ * Room changes are collected until control returns to the event loop;
+ * then the rooms are repositioned and the changes are reported as few
+ * contiguous dataChanged() ranges, each with the roles that changed.
+ */
 class RoomListModel: public QAbstractListModel
 {
         Q_OBJECT
@@ -37,6 +53,18 @@ class RoomListModel: public QAbstractListModel
         enum Roles {
             HasUnreadRole = Qt::UserRole + 1,
             HighlightCountRole,
+            /** RowFlags of the row, for painting it with one data() call */
+            RowFlagsRole,
+        };
+
+        enum RowFlag {
+            UnreadFlag = 0x1,
+            HighlightedFlag = 0x2,
+        };
+
+        enum Order {
+            ActivityOrder, ///< Most recently active rooms first
+            UnreadOrder, ///< Rooms with highlights, then with unread messages
         };
 
         RoomListModel(QObject* parent = nullptr);
@@ -44,6 +72,10 @@ class RoomListModel: public QAbstractListModel
 
         void setConnection(QMatrixClient::Connection* connection);
         QuaternionRoom* roomAt(int row);
+        int rowOf(QuaternionRoom* room) const;
+
+        Order order() const;
+        void setOrder(Order order);
 
         QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
         int rowCount(const QModelIndex& parent=QModelIndex()) const override;
@@ -51,13 +83,57 @@ class RoomListModel: public QAbstractListModel
     private slots:
         void displaynameChanged(QMatrixClient::Room* room);
         void unreadMessagesChanged(QMatrixClient::Room* room);
+        void highlightCountChanged(QMatrixClient::Room* room);
+        void activityChanged(QuaternionRoom* room);
         void addRoom(QMatrixClient::Room* room);
+        void flushChanges();
 
     private:
+        enum Change {
+            NameChange = 0x1,
+            UnreadChange = 0x2,
+            HighlightChange = 0x4,
+            ActivityChange = 0x8,
+        };
+
+        /** What a row shows, rebuilt only after the room reports a change */
+        struct RowData
+        {
+            QString name;
+            QString toolTip;
+            int joinState;
+            bool unread;
+            int highlightCount;
+        };
+
+        struct SortKey
+        {
+            bool highlighted;
+            bool unread;
+            QDateTime lastActivity;
+            QString name;
+            QString id;
+        };
+
         QMatrixClient::Connection* m_connection;
-        QList<QuaternionRoom*> m_rooms;
+        Order m_order;
+        QVector<QuaternionRoom*> m_rooms;
+        QHash<QuaternionRoom*, int> m_rows;
+        QHash<QuaternionRoom*, SortKey> m_keys;
+        QHash<QuaternionRoom*, int> m_changes;
+        mutable QHash<QuaternionRoom*, RowData> m_rowData;
+        QTimer m_flushTimer;
 
         void doAddRoom(QMatrixClient::Room* r);
+        SortKey sortKey(QuaternionRoom* room) const;
+        bool lessThan(const SortKey& a, const SortKey& b) const;
+        int lowerBound(const SortKey& key) const;
+        void reposition(QuaternionRoom* room);
+        void updateRows(int from, int to);
+        void markChanged(QMatrixClient::Room* room, Change change);
+        static QVector<int> rolesFor(int changes);
+        const RowData& rowData(QuaternionRoom* room) const;
+        static QIcon joinStateIcon(int joinState);
 };
 
 #endif // ROOMLISTMODEL_H
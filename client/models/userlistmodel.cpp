@@ -20,48 +20,32 @@
 #include "userlistmodel.h"
 
 #include <QtCore/QDebug>
-#include <QtCore/QVector>
+#include <QtCore/QMetaObject>
 #include <QtGui/QPixmap>
 
 #include "lib/connection.h"
 #include "lib/room.h"
 #include "lib/user.h"
+#include "../avatarcache.h"
+#include "../quaternionroom.h"
+#include "../membersearchindex.h"
+#include "../sortedmemberlist.h"
 
-class MemberNameSorter
-{
-        using Room = QMatrixClient::Room;
-        using User = QMatrixClient::User;
-    public:
-        MemberNameSorter(Room* r) : room(r) { }
-
-        bool operator()(User* u1, User* u2) const
-        {
-            auto n1 = room->roomMembername(u1);
-            auto n2 = room->roomMembername(u2);
-            if (n1[0] == '@')
-                n1.remove(0, 1);
-            if (n2[0] == '@')
-                n2.remove(0, 1);
-            return n1 < n2;
-        }
-
-        template <typename ContT>
-        typename ContT::size_type lowerBoundIndex(const ContT& c,
-                                                  typename ContT::value_type v) const
-        {
-            return  std::lower_bound(c.begin(), c.end(), v, *this) - c.begin();
-        }
-
-    private:
-        Room* room;
-};
+#include <algorithm>
 
+static const int FetchBatchSize = 200;
 
 UserListModel::UserListModel(QObject* parent)
     : QAbstractListModel(parent)
 {
     m_connection = nullptr;
     m_currentRoom = nullptr;
+    m_members = nullptr;
+    m_loadedRows = 0;
+    m_pendingChange = NoChange;
+    m_changedRow = -1;
+    m_refilterPending = false;
+    m_indexedRows = 0;
 }
 
 UserListModel::~UserListModel()
@@ -75,32 +59,121 @@ void UserListModel::setConnection(QMatrixClient::Connection* connection)
     m_connection = connection;
 }
 
-void UserListModel::setRoom(QMatrixClient::Room* room)
+void UserListModel::setRoom(QuaternionRoom* room)
 {
-    using namespace QMatrixClient;
     beginResetModel();
-    if( m_currentRoom )
+    if( m_members )
     {
-        m_currentRoom->disconnect( this );
-        for( User* user: m_users )
-            user->disconnect( this );
-        m_users.clear();
+        untrackLoadedRows();
+        m_members->disconnect( this );
+        m_members = nullptr;
     }
+    m_loadedRows = 0;
+    m_filtered.clear();
+    m_rows.clear();
+    m_indexedRows = 0;
     m_currentRoom = room;
     if( m_currentRoom )
     {
-        connect( m_currentRoom, &Room::userAdded, this, &UserListModel::userAdded );
-        connect( m_currentRoom, &Room::userRemoved, this, &UserListModel::userRemoved );
-        connect( m_currentRoom, &Room::memberRenamed, this, &UserListModel::memberRenamed );
-        m_users = m_currentRoom->users();
-        std::sort(m_users.begin(), m_users.end(), MemberNameSorter(room));
-        for( User* user: m_users )
-        {
-            connect( user, &User::avatarChanged, this, &UserListModel::avatarChanged );
-        }
-        qDebug() << m_users.count() << "user(s) in the room";
+        // The room keeps its members sorted, even when it's not shown;
+        // rows are only materialized when the view asks for them.
+        m_members = m_currentRoom->sortedMembers();
+        connect( m_members, &SortedMemberList::aboutToInsert, this, &UserListModel::aboutToInsert );
+        connect( m_members, &SortedMemberList::inserted, this, &UserListModel::inserted );
+        connect( m_members, &SortedMemberList::aboutToRemove, this, &UserListModel::aboutToRemove );
+        connect( m_members, &SortedMemberList::removed, this, &UserListModel::removed );
+        connect( m_members, &SortedMemberList::aboutToMove, this, &UserListModel::aboutToMove );
+        connect( m_members, &SortedMemberList::moved, this, &UserListModel::moved );
+        connect( m_members, &SortedMemberList::changed, this, &UserListModel::memberChanged );
+        qDebug() << m_members->count() << "user(s) in the room";
     }
     endResetModel();
+    emit memberCountChanged(memberCount());
+    if( isFiltered() )
+        refilter();
+}
+
+void UserListModel::setFilter(const QString& filter)
+{
+    QString trimmed = filter.trimmed();
+    if( trimmed == m_filter )
+        return;
+    beginResetModel();
+    // Stop tracking the rows while they can still be told apart
+    if( m_members )
+        untrackLoadedRows();
+    m_loadedRows = 0;
+    m_rows.clear();
+    m_indexedRows = 0;
+    m_filter = trimmed;
+    findMatches();
+    endResetModel();
+}
+
+void UserListModel::refilter()
+{
+    m_refilterPending = false;
+    beginResetModel();
+    if( m_members )
+        untrackLoadedRows();
+    m_loadedRows = 0;
+    m_rows.clear();
+    m_indexedRows = 0;
+    findMatches();
+    endResetModel();
+}
+
+void UserListModel::findMatches()
+{
+    m_filtered.clear();
+    if( m_currentRoom && isFiltered() )
+    {
+        // Only the matches are looked at, so the cost doesn't depend on
+        // the size of the room
+        m_filtered = m_currentRoom->memberSearchIndex()->find(m_filter);
+        QVector< QPair<int, QMatrixClient::User*> > positions;
+        positions.reserve(m_filtered.size());
+        for( auto u: m_filtered )
+            positions.push_back(qMakePair(m_members->indexOf(u), u));
+        std::sort(positions.begin(), positions.end());
+        for( int i = 0; i < positions.size(); ++i )
+            m_filtered[i] = positions.at(i).second;
+    }
+}
+
+void UserListModel::scheduleRefilter()
+{
+    // Let the search index catch up with the same membership change first
+    if( m_refilterPending )
+        return;
+    m_refilterPending = true;
+    QMetaObject::invokeMethod(this, "refilter", Qt::QueuedConnection);
+}
+
+bool UserListModel::isFiltered() const
+{
+    return !m_filter.isEmpty();
+}
+
+int UserListModel::sourceCount() const
+{
+    return isFiltered() ? m_filtered.size() : memberCount();
+}
+
+QMatrixClient::User* UserListModel::userAt(int row) const
+{
+    return isFiltered() ? m_filtered.at(row) : m_members->at(row);
+}
+
+void UserListModel::untrackLoadedRows()
+{
+    for( int i = 0; i < m_loadedRows; ++i )
+        untrackUser(userAt(i));
+}
+
+int UserListModel::memberCount() const
+{
+    return m_members ? m_members->count() : 0;
 }
 
 QVariant UserListModel::data(const QModelIndex& index, int role) const
@@ -108,19 +181,19 @@ QVariant UserListModel::data(const QModelIndex& index, int role) const
     if( !index.isValid() )
         return QVariant();
 
-    if( index.row() >= m_users.count() )
+    if( index.row() >= rowCount() )
     {
-        qDebug() << "UserListModel, something's wrong: index.row() >= m_users.count()";
+        qDebug() << "UserListModel, something's wrong: index.row() >= rowCount()";
         return QVariant();
     }
-    QMatrixClient::User* user = m_users.at(index.row());
+    QMatrixClient::User* user = userAt(index.row());
     if( role == Qt::DisplayRole )
     {
         return m_currentRoom->roomMembername(user);
     }
     if( role == Qt::DecorationRole )
     {
-        return user->avatar(25,25);
+        return AvatarCache::instance()->avatar(user, 25, 25);
     }
     return QVariant();
 }
@@ -130,46 +203,186 @@ int UserListModel::rowCount(const QModelIndex& parent) const
     if( parent.isValid() )
         return 0;
 
-    return m_users.count();
+    return m_loadedRows;
+}
+
+bool UserListModel::canFetchMore(const QModelIndex& parent) const
+{
+    return !parent.isValid() && m_loadedRows < sourceCount();
 }
 
-void UserListModel::userAdded(QMatrixClient::User* user)
+void UserListModel::fetchMore(const QModelIndex& parent)
 {
-    auto pos = MemberNameSorter(m_currentRoom).lowerBoundIndex(m_users, user);
-    beginInsertRows(QModelIndex(), pos, pos);
-    m_users.insert(pos, user);
+    if( parent.isValid() )
+        return;
+
+    int count = qMin(FetchBatchSize, sourceCount() - m_loadedRows);
+    if( count <= 0 )
+        return;
+    beginInsertRows(QModelIndex(), m_loadedRows, m_loadedRows + count - 1);
+    for( int i = m_loadedRows; i < m_loadedRows + count; ++i )
+        trackUser(userAt(i));
+    m_loadedRows += count;
     endInsertRows();
-    connect( user, &QMatrixClient::User::avatarChanged, this, &UserListModel::avatarChanged );
 }
 
-void UserListModel::userRemoved(QMatrixClient::User* user)
+void UserListModel::trackUser(QMatrixClient::User* user)
+{
+    connect( user, &QMatrixClient::User::avatarChanged,
+             this, &UserListModel::avatarChanged, Qt::UniqueConnection );
+}
+
+void UserListModel::untrackUser(QMatrixClient::User* user)
 {
-    auto pos = MemberNameSorter(m_currentRoom).lowerBoundIndex(m_users, user);
-    if (pos != m_users.size())
+    disconnect( user, &QMatrixClient::User::avatarChanged,
+                this, &UserListModel::avatarChanged );
+}
+
+int UserListModel::rowOf(QMatrixClient::User* user)
+{
+    auto it = m_rows.find(user);
+    if (it != m_rows.end() && *it < m_indexedRows && userAt(*it) == user)
+        return *it;
+
+    // Extend the valid part of the index until the user shows up
+    while (m_indexedRows < m_loadedRows)
+    {
+        QMatrixClient::User* u = userAt(m_indexedRows);
+        m_rows.insert(u, m_indexedRows);
+        if (u == user)
+            return m_indexedRows++;
+        ++m_indexedRows;
+    }
+    return -1;
+}
+
+void UserListModel::invalidateRows(int from)
+{
+    m_indexedRows = qMin(m_indexedRows, from);
+}
+
+void UserListModel::aboutToInsert(int pos)
+{
+    if (isFiltered())
+    {
+        m_pendingChange = NoChange;
+        return;
+    }
+    // Members beyond the materialized rows will come with fetchMore();
+    // appending to a fully loaded list is shown right away though.
+    m_pendingChange = pos < m_loadedRows || m_loadedRows == memberCount()
+                      ? InsertRow : NoChange;
+    m_changedRow = pos;
+    if (m_pendingChange == InsertRow)
+    {
+        invalidateRows(pos);
+        beginInsertRows(QModelIndex(), pos, pos);
+    }
+}
+
+void UserListModel::inserted()
+{
+    if (m_pendingChange == InsertRow)
+    {
+        ++m_loadedRows;
+        endInsertRows();
+        trackUser(m_members->at(m_changedRow));
+    }
+    m_pendingChange = NoChange;
+    if (isFiltered())
+        scheduleRefilter();
+    emit memberCountChanged(memberCount());
+}
+
+void UserListModel::aboutToRemove(int pos)
+{
+    if (isFiltered())
+    {
+        m_pendingChange = NoChange;
+        return;
+    }
+    m_pendingChange = pos < m_loadedRows ? RemoveRow : NoChange;
+    if (m_pendingChange == RemoveRow)
     {
+        invalidateRows(pos);
+        m_rows.remove(m_members->at(pos));
+        untrackUser(m_members->at(pos));
         beginRemoveRows(QModelIndex(), pos, pos);
-        m_users.removeAt(pos);
+    }
+}
+
+void UserListModel::removed()
+{
+    if (m_pendingChange == RemoveRow)
+    {
+        --m_loadedRows;
         endRemoveRows();
-        disconnect( user, &QMatrixClient::User::avatarChanged, this, &UserListModel::avatarChanged );
-    } else
-        qWarning() << "Trying to remove a room member not in the user list";
+    }
+    m_pendingChange = NoChange;
+    if (isFiltered())
+        scheduleRefilter();
+    emit memberCountChanged(memberCount());
 }
 
-void UserListModel::memberRenamed(QMatrixClient::User *user)
+void UserListModel::aboutToMove(int from, int to)
 {
-    auto pos = MemberNameSorter(m_currentRoom).lowerBoundIndex(m_users, user);
-    if ( pos != m_users.size() )
-        emit dataChanged(index(pos), index(pos), {Qt::DisplayRole} );
+    const bool fromLoaded = from < m_loadedRows;
+    const bool toLoaded = to < m_loadedRows;
+    m_changedRow = to;
+    if (isFiltered())
+        m_pendingChange = NoChange;
+    else if (fromLoaded && toLoaded)
+    {
+        m_pendingChange = MoveRow;
+        invalidateRows(qMin(from, to));
+        // beginMoveRows() wants the row before which to insert, counted
+        // before the move
+        beginMoveRows(QModelIndex(), from, from, QModelIndex(), to > from ? to + 1 : to);
+    }
+    else if (fromLoaded)
+        aboutToRemove(from); // Moves out of the materialized rows
+    else if (toLoaded)
+        aboutToInsert(to); // Moves into them
     else
-        qWarning() << "Trying to access a room member not in the user list";
+        m_pendingChange = NoChange;
+}
+
+void UserListModel::moved()
+{
+    switch (m_pendingChange)
+    {
+        case MoveRow:
+            endMoveRows();
+            break;
+        case RemoveRow:
+            --m_loadedRows;
+            endRemoveRows();
+            break;
+        case InsertRow:
+            ++m_loadedRows;
+            endInsertRows();
+            trackUser(m_members->at(m_changedRow));
+            break;
+        default:;
+    }
+    m_pendingChange = NoChange;
+    if (isFiltered())
+        scheduleRefilter();
+}
+
+void UserListModel::memberChanged(int pos)
+{
+    if (isFiltered())
+        scheduleRefilter();
+    else if (pos < m_loadedRows)
+        emit dataChanged(index(pos), index(pos), {Qt::DisplayRole} );
 }
 
 void UserListModel::avatarChanged(QMatrixClient::User* user)
 {
-    auto pos = MemberNameSorter(m_currentRoom).lowerBoundIndex(m_users, user);
-    if ( pos != m_users.size() )
+    auto pos = rowOf(user);
+    if ( pos != -1 )
         emit dataChanged(index(pos), index(pos), {Qt::DecorationRole} );
     else
         qWarning() << "Trying to access a room member not in the user list";
 }
-
@@ -21,6 +21,8 @@
 #define USERLISTMODEL_H
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
 
 namespace QMatrixClient
 {
@@ -28,7 +30,20 @@ namespace QMatrixClient
     class Room;
     class User;
 }
+class QuaternionRoom;
+class SortedMemberList;
 
+/**
+ * Members of the current room, in the order of the room's SortedMemberList.
+ *
+ * Rows are materialized in batches through canFetchMore()/fetchMore(), so
+ * only the members that have been scrolled to are exposed to the view and
+ * have their avatar changes tracked. The total number of members is
+ * available right away from memberCount().
+ *
+ * With a filter set, the rows are the matches from the room's
+ * MemberSearchIndex instead, kept in the same order.
+ */
 class UserListModel: public QAbstractListModel
 {
         Q_OBJECT
@@ -37,21 +52,62 @@ class UserListModel: public QAbstractListModel
         virtual ~UserListModel();
 
         void setConnection(QMatrixClient::Connection* connection);
-        void setRoom(QMatrixClient::Room* room);
+        void setRoom(QuaternionRoom* room);
+        void setFilter(const QString& filter);
+
+        int memberCount() const;
 
         QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
         int rowCount(const QModelIndex& parent=QModelIndex()) const override;
+        bool canFetchMore(const QModelIndex& parent) const override;
+        void fetchMore(const QModelIndex& parent) override;
+
+    signals:
+        void memberCountChanged(int count);
 
     private slots:
-        void userAdded(QMatrixClient::User* user);
-        void userRemoved(QMatrixClient::User* user);
-        void memberRenamed(QMatrixClient::User* user);
+        void aboutToInsert(int pos);
+        void inserted();
+        void aboutToRemove(int pos);
+        void removed();
+        void aboutToMove(int from, int to);
+        void moved();
+        void memberChanged(int pos);
         void avatarChanged(QMatrixClient::User* user);
+        void refilter();
 
     private:
+        /** How a change in the member list maps to the materialized rows */
+        enum PendingChange { NoChange, InsertRow, RemoveRow, MoveRow };
+
         QMatrixClient::Connection* m_connection;
-        QMatrixClient::Room* m_currentRoom;
-        QList<QMatrixClient::User*> m_users;
+        QuaternionRoom* m_currentRoom;
+        SortedMemberList* m_members;
+        int m_loadedRows;
+        PendingChange m_pendingChange;
+        int m_changedRow;
+        QString m_filter;
+        QVector<QMatrixClient::User*> m_filtered;
+        bool m_refilterPending;
+
+        /**
+         * User to row index. Rows below m_indexedRows have up-to-date
+         * entries; the rest is refreshed lazily, as insertions and removals
+         * shift all the rows after them.
+         */
+        QHash<QMatrixClient::User*, int> m_rows;
+        int m_indexedRows;
+
+        bool isFiltered() const;
+        int sourceCount() const;
+        QMatrixClient::User* userAt(int row) const;
+        void scheduleRefilter();
+        void findMatches();
+        void untrackLoadedRows();
+        int rowOf(QMatrixClient::User* user);
+        void invalidateRows(int from);
+        void trackUser(QMatrixClient::User* user);
+        void untrackUser(QMatrixClient::User* user);
 };
 
 #endif // USERLISTMODEL_H
@@ -0,0 +1,356 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "outgoingqueue.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QUrl>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+#include "quaternionconnection.h"
+#include "quaternionroom.h"
+#include "uploadmanager.h"
+
+static const int FirstRetryDelay = 1000; // ms
+static const int MaxRetryDelay = 60 * 1000;
+
+OutgoingQueue::OutgoingQueue(QuaternionConnection* connection, QObject* parent)
+    : QObject(parent)
+    , m_connection(connection)
+{
+    m_retryTimer.setSingleShot(true);
+    connect( &m_retryTimer, &QTimer::timeout, this, &OutgoingQueue::retryDue );
+    connect( connection, &QMatrixClient::Connection::newRoom, this, &OutgoingQueue::roomAdded );
+    for (QMatrixClient::Room* r: connection->roomMap())
+        connectRoom(static_cast<QuaternionRoom*>(r));
+    // The queue is kept per user, so it can only be read after logging in
+    if (connection->userId().isEmpty())
+        connect( connection, &QMatrixClient::Connection::connected, this, &OutgoingQueue::restore );
+    else
+        restore();
+}
+
+OutgoingQueue::~OutgoingQueue()
+{
+    for (auto& q: m_queues)
+        if (q.reply)
+        {
+            q.reply->disconnect(this);
+            q.reply->abort();
+        }
+}
+
+void OutgoingQueue::send(QuaternionRoom* room, const QString& msgType, const QString& body)
+{
+    Outgoing message;
+    message.txnId = UploadManager::newTxnId();
+    message.msgType = msgType;
+    message.body = body;
+    message.timestamp = QDateTime::currentDateTimeUtc();
+    message.attempts = 0;
+    message.failed = false;
+    message.session = session();
+    m_queues[room->id()].messages.append(message);
+    addPendingEvent(room, message);
+    save();
+    sendNext(room->id());
+}
+
+void OutgoingQueue::restore()
+{
+    if (!m_fileName.isEmpty())
+        return;
+    m_fileName = QDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/outbox")
+        .filePath(QString::fromLatin1(QUrl::toPercentEncoding(m_connection->userId())) + ".json");
+
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    const QJsonObject rooms = QJsonDocument::fromJson(file.readAll()).object();
+    int count = 0;
+    for (auto it = rooms.begin(); it != rooms.end(); ++it)
+    {
+        QList<Outgoing> restored;
+        for (const QJsonValue& v: it.value().toArray())
+        {
+            const QJsonObject json = v.toObject();
+            Outgoing message;
+            message.txnId = json.value("txn_id").toString();
+            message.msgType = json.value("msgtype").toString();
+            message.body = json.value("body").toString();
+            message.timestamp = QDateTime::fromMSecsSinceEpoch(
+                qint64(json.value("timestamp").toDouble())).toUTC();
+            message.attempts = 0;
+            message.session = json.value("session").toString();
+            // Sent in another session, the message may have got through
+            // already without the server being able to tell
+            message.failed = json.value("failed").toBool() ||
+                             message.session != session();
+            if (!message.txnId.isEmpty())
+                restored.append(message);
+        }
+        if (QuaternionRoom* r = room(it.key()))
+            for (const Outgoing& message: restored)
+                addPendingEvent(r, message);
+        RoomQueue& q = m_queues[it.key()];
+        q.messages = restored + q.messages;
+        count += restored.size();
+    }
+    qDebug() << "Restored" << count << "unsent message(s)";
+    // Sending with the same transaction ids again is safe: the server
+    // ignores the ones it has got already
+    for (const QString& roomId: rooms.keys())
+        sendNext(roomId);
+}
+
+void OutgoingQueue::roomAdded(QMatrixClient::Room* room)
+{
+    connectRoom(static_cast<QuaternionRoom*>(room));
+    const auto it = m_queues.find(room->id());
+    if (it == m_queues.end())
+        return;
+    for (const Outgoing& message: it->messages)
+        addPendingEvent(static_cast<QuaternionRoom*>(room), message);
+}
+
+void OutgoingQueue::connectRoom(QuaternionRoom* room)
+{
+    const QString roomId = room->id();
+    connect( room, &QuaternionRoom::pendingEventRetryRequested, this,
+             [=](const QString& txnId) { retry(roomId, txnId); } );
+    connect( room, &QuaternionRoom::pendingEventDiscardRequested, this,
+             [=](const QString& txnId) { discard(roomId, txnId); } );
+}
+
+int OutgoingQueue::indexOf(const RoomQueue& q, const QString& txnId) const
+{
+    for (int i = 0; i < q.messages.size(); ++i)
+        if (q.messages.at(i).txnId == txnId)
+            return i;
+    return -1;
+}
+
+void OutgoingQueue::sendNext(const QString& roomId)
+{
+    RoomQueue& q = m_queues[roomId];
+    if (q.reply || q.retryAt != 0)
+        return;
+    // Failed messages are skipped, the rest still go in order
+    int i = 0;
+    while (i < q.messages.size() && q.messages.at(i).failed)
+        ++i;
+    if (i == q.messages.size())
+        return;
+
+    const Outgoing& message = q.messages.at(i);
+    QJsonObject content;
+    content.insert("msgtype", message.msgType);
+    content.insert("body", message.body);
+    QNetworkRequest request = m_connection->makeRequest(
+        QString("/_matrix/client/r0/rooms/%1/send/m.room.message/%2")
+            .arg(QString::fromLatin1(QUrl::toPercentEncoding(roomId)),
+                 QString::fromLatin1(QUrl::toPercentEncoding(message.txnId))));
+    QNetworkReply* reply = m_connection->nam()->put(request,
+                                QJsonDocument(content).toJson(QJsonDocument::Compact));
+    q.reply = reply;
+    if (QuaternionRoom* r = room(roomId))
+        r->updatePendingEvent(message.txnId, PendingEvent::Sending);
+    const QString txnId = message.txnId;
+    connect( reply, &QNetworkReply::finished, this, [=] { sent(roomId, txnId, reply); } );
+}
+
+void OutgoingQueue::sent(const QString& roomId, const QString& txnId, QNetworkReply* reply)
+{
+    reply->deleteLater();
+    RoomQueue& q = m_queues[roomId];
+    q.reply = nullptr;
+    const int i = indexOf(q, txnId);
+    if (i == -1)
+        return;
+    Outgoing& message = q.messages[i];
+    QuaternionRoom* r = room(roomId);
+
+    if (reply->error() == QNetworkReply::NoError)
+    {
+        // The pending event stays until the event comes back in a sync
+        if (r)
+            r->updatePendingEvent(message.txnId, PendingEvent::Sent, 1.0);
+        q.messages.removeAt(i);
+        save();
+        sendNext(roomId);
+        return;
+    }
+
+    const int httpStatus =
+        reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const QJsonObject json = QJsonDocument::fromJson(reply->readAll()).object();
+    if (httpStatus >= 400 && httpStatus < 500 && httpStatus != 429)
+    {
+        // Sending the same again won't help; it's up to the user now
+        qWarning() << "Message" << message.txnId << "rejected:" << httpStatus
+                   << json.value("error").toString();
+        if (r)
+            r->updatePendingEvent(message.txnId, PendingEvent::Failed);
+        message.failed = true;
+        save();
+        sendNext(roomId);
+        return;
+    }
+
+    ++message.attempts;
+    int delay = int(qMin(qint64(MaxRetryDelay),
+                         qint64(FirstRetryDelay) << qMin(message.attempts - 1, 16)));
+    delay = delay / 2 + qrand() % (delay / 2 + 1);
+    delay = qMax(delay, json.value("retry_after_ms").toInt());
+    qDebug() << "Sending" << message.txnId << "failed:" << reply->errorString()
+             << "- retrying in" << delay << "ms";
+    if (r)
+        r->updatePendingEvent(message.txnId, PendingEvent::Queued);
+    q.retryAt = QDateTime::currentMSecsSinceEpoch() + delay;
+    scheduleRetry();
+}
+
+void OutgoingQueue::retry(const QString& roomId, const QString& txnId)
+{
+    RoomQueue& q = m_queues[roomId];
+    const int i = indexOf(q, txnId);
+    if (i == -1 || !q.messages.at(i).failed)
+        return;
+    q.messages[i].failed = false;
+    q.messages[i].attempts = 0;
+    q.messages[i].session = session();
+    if (QuaternionRoom* r = room(roomId))
+        r->updatePendingEvent(txnId, PendingEvent::Queued);
+    save();
+    sendNext(roomId);
+}
+
+void OutgoingQueue::discard(const QString& roomId, const QString& txnId)
+{
+    RoomQueue& q = m_queues[roomId];
+    const int i = indexOf(q, txnId);
+    if (i == -1 || !q.messages.at(i).failed)
+        return;
+    q.messages.removeAt(i);
+    if (QuaternionRoom* r = room(roomId))
+        r->removePendingEvent(txnId);
+    save();
+}
+
+void OutgoingQueue::retryDue()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QStringList due;
+    for (auto it = m_queues.begin(); it != m_queues.end(); ++it)
+        if (it->retryAt != 0 && it->retryAt <= now)
+        {
+            it->retryAt = 0;
+            due.append(it.key());
+        }
+    for (const QString& roomId: due)
+        sendNext(roomId);
+    scheduleRetry();
+}
+
+void OutgoingQueue::scheduleRetry()
+{
+    qint64 next = 0;
+    for (const RoomQueue& q: m_queues)
+        if (q.retryAt != 0 && (next == 0 || q.retryAt < next))
+            next = q.retryAt;
+    if (next == 0)
+        m_retryTimer.stop();
+    else
+        m_retryTimer.start(int(qMax(qint64(0), next - QDateTime::currentMSecsSinceEpoch())));
+}
+
+void OutgoingQueue::addPendingEvent(QuaternionRoom* room, const Outgoing& message)
+{
+    PendingEvent pending;
+    pending.txnId = message.txnId;
+    pending.msgType = message.msgType;
+    pending.body = message.body;
+    pending.timestamp = message.timestamp;
+    pending.status = message.failed ? PendingEvent::Failed : PendingEvent::Queued;
+    pending.progress = -1;
+    room->addPendingEvent(pending);
+}
+
+QuaternionRoom* OutgoingQueue::room(const QString& roomId) const
+{
+    return static_cast<QuaternionRoom*>(m_connection->roomMap().value(roomId));
+}
+
+QString OutgoingQueue::session() const
+{
+    return QString::fromLatin1(QCryptographicHash::hash(
+        m_connection->accessToken().toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+void OutgoingQueue::save()
+{
+    if (m_fileName.isEmpty())
+        return;
+
+    QJsonObject rooms;
+    for (auto it = m_queues.begin(); it != m_queues.end(); ++it)
+    {
+        QJsonArray messages;
+        for (const Outgoing& message: it->messages)
+        {
+            QJsonObject json;
+            json.insert("txn_id", message.txnId);
+            json.insert("msgtype", message.msgType);
+            json.insert("body", message.body);
+            json.insert("timestamp", double(message.timestamp.toMSecsSinceEpoch()));
+            json.insert("session", message.session);
+            if (message.failed)
+                json.insert("failed", true);
+            messages.append(json);
+        }
+        if (!messages.isEmpty())
+            rooms.insert(it.key(), messages);
+    }
+    if (rooms.isEmpty())
+    {
+        QFile::remove(m_fileName);
+        return;
+    }
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Couldn't save unsent messages:" << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(rooms).toJson(QJsonDocument::Compact));
+    if (!file.commit())
+        qWarning() << "Couldn't save unsent messages:" << file.errorString();
+}
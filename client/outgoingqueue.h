@@ -0,0 +1,107 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef OUTGOINGQUEUE_H
+#define OUTGOINGQUEUE_H
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QDateTime>
+#include <QtCore/QTimer>
+
+namespace QMatrixClient
+{
+    class Room;
+}
+
+class QuaternionConnection;
+class QuaternionRoom;
+class QNetworkReply;
+
+/**
+ * Sends text messages.
+ *
+ * A message shows up in its room as a pending event as soon as it is
+ * queued. Every room has its own queue that is sent in order, one message
+ * at a time; failed sends are retried with a growing delay of up to a
+ * minute. Messages the server rejected for good stay in the queue as
+ * failed, out of the sending order, until the user retries or discards
+ * them from their pending row. The queue is kept on disk, so messages not
+ * sent yet are sent after a restart. The pending event goes away when the
+ * server sends the message back with its transaction id.
+ *
+ * The server only recognizes a transaction id within the session (access
+ * token) it was used in, so messages queued in another session are
+ * restored as failed instead of being sent again.
+ */
+class OutgoingQueue: public QObject
+{
+        Q_OBJECT
+    public:
+        OutgoingQueue(QuaternionConnection* connection, QObject* parent = nullptr);
+        virtual ~OutgoingQueue();
+
+        void send(QuaternionRoom* room, const QString& msgType, const QString& body);
+
+    private slots:
+        void restore();
+        void roomAdded(QMatrixClient::Room* room);
+        void retryDue();
+
+    private:
+        struct Outgoing
+        {
+            QString txnId;
+            QString msgType;
+            QString body;
+            QDateTime timestamp;
+            int attempts;
+            bool failed; // Rejected by the server, waits for the user
+            QString session; // Of the access token it's sent with, see session()
+        };
+        struct RoomQueue
+        {
+            QList<Outgoing> messages;
+            QNetworkReply* reply; // Of the first message, if it's being sent
+            qint64 retryAt; // ms since epoch, or 0 if not waiting
+
+            RoomQueue() : reply(nullptr), retryAt(0) { }
+        };
+
+        QuaternionConnection* m_connection;
+        QHash<QString, RoomQueue> m_queues; // By room id
+        QTimer m_retryTimer;
+        QString m_fileName;
+
+        void connectRoom(QuaternionRoom* room);
+        void sendNext(const QString& roomId);
+        void sent(const QString& roomId, const QString& txnId, QNetworkReply* reply);
+        void retry(const QString& roomId, const QString& txnId);
+        void discard(const QString& roomId, const QString& txnId);
+        int indexOf(const RoomQueue& q, const QString& txnId) const;
+        void scheduleRetry();
+        void addPendingEvent(QuaternionRoom* room, const Outgoing& message);
+        QuaternionRoom* room(const QString& roomId) const;
+        /** Identifies the current access token without storing it */
+        QString session() const;
+        void save();
+};
+
+#endif // OUTGOINGQUEUE_H
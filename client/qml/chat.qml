@@ -11,6 +11,7 @@ Rectangle {
     color: defaultPalette.base
 
     signal getPreviousContent()
+    signal showImage(int row)
 
     Timer{
         id: scrollTimer
@@ -132,6 +133,12 @@ Rectangle {
             width: chatView.width
             height: childrenRect.height
 
+            // Delegates only exist for rows in sight, so this is when a gap
+            // gets filled; a partly filled gap gets a new token and goes on
+            property string gap: eventType == "gap" ? gapToken : ""
+            onGapChanged: if (gap != "") messageModel.fillGap(index)
+            Component.onCompleted: if (gap != "") messageModel.fillGap(index)
+
             RowLayout {
                 id: message
                 width: parent.width
@@ -139,7 +146,9 @@ Rectangle {
 
                 property string textColor:
                         if (highlight) decoration
-                        else if (eventType == "state" || eventType == "other") disabledPalette.text
+                        else if (eventType == "state" || eventType == "other"
+                                 || eventType == "gap"
+                                 || pending !== undefined) disabledPalette.text
                         else defaultPalette.text
 
                 Label {
@@ -153,7 +162,7 @@ Rectangle {
                     Layout.preferredWidth: 120
                     elide: Text.ElideRight
                     text: eventType == "state" || eventType == "emote" ? "* " + author :
-                          eventType != "other" ? author : "***"
+                          eventType != "other" && eventType != "gap" ? author : "***"
                     horizontalAlignment: if( ["other", "emote", "state"]
                                                  .indexOf(eventType) >= 0 )
                                          { Text.AlignRight }
@@ -188,13 +197,101 @@ Rectangle {
                                 Qt.openUrlExternally(link)
                             }
                         }
-                        Image {
+                        Item {
                             id: imageField
-                            fillMode: Image.PreserveAspectFit
                             width: eventType == "image" ? parent.width : 0
+                            // The size from the event sets the row height right
+                            // away; without it, the tiny preview arrives first
+                            // and fixes the height to what the thumbnail will take
+                            property real aspectRatio:
+                                imageSize !== undefined ? imageSize.height / imageSize.width :
+                                preview.status == Image.Ready && preview.implicitWidth > 0 ?
+                                    preview.implicitHeight / preview.implicitWidth :
+                                thumbnail.status == Image.Ready && thumbnail.implicitWidth > 0 ?
+                                    thumbnail.implicitHeight / thumbnail.implicitWidth : 0
+                            // Small images are shown at their own size, not blown up
+                            property real naturalWidth:
+                                imageSize !== undefined ? imageSize.width :
+                                thumbnail.status == Image.Ready ? thumbnail.implicitWidth : 500
+                            height: eventType != "image" ? 0 :
+                                    Math.min(width, naturalWidth,
+                                             aspectRatio <= 1 ? 500 : 500 / aspectRatio)
+                                    * aspectRatio
+
+                            Image {
+                                id: preview
+                                anchors.fill: parent
+                                fillMode: Image.PreserveAspectFit
+                                horizontalAlignment: Image.AlignLeft
+                                visible: thumbnail.status != Image.Ready
+                                smooth: true
+
+                                sourceSize: eventType == "image" ? "32x32" : "0x0"
+                                source: eventType == "image" && previewContent !== undefined ?
+                                            previewContent : ""
+                            }
+                            Image {
+                                id: thumbnail
+                                anchors.fill: parent
+                                fillMode: Image.PreserveAspectFit
+                                horizontalAlignment: Image.AlignLeft
+
+                                sourceSize: eventType == "image" ? "500x500" : "0x0"
+                                source: eventType == "image" ? content : ""
+                            }
+                            MouseArea {
+                                anchors.fill: parent
+                                enabled: eventType == "image"
+                                cursorShape: Qt.PointingHandCursor
+                                onClicked: root.showImage(index)
+                            }
+                        }
+                        RowLayout {
+                            visible: pending !== undefined
+                            height: visible ? implicitHeight : 0
+                            width: parent.width
+
+                            Label {
+                                text: pending !== undefined ? pending : ""
+                                color: disabledPalette.text
+                            }
+                            ProgressBar {
+                                Layout.fillWidth: true
+                                visible: progress !== undefined && progress < 1
+                                value: progress !== undefined ? progress : 0
+                            }
+                            Button {
+                                text: "Retry"
+                                visible: failed === true
+                                onClicked: messageModel.retryPending(index)
+                            }
+                            Button {
+                                text: "Discard"
+                                visible: failed === true
+                                onClicked: messageModel.discardPending(index)
+                            }
+                        }
+                        RowLayout {
+                            visible: eventType == "file"
+                            height: visible ? implicitHeight : 0
+                            width: parent.width
 
-                            sourceSize: eventType == "image" ? "500x500" : "0x0"
-                            source: eventType == "image" ? content : ""
+                            ProgressBar {
+                                Layout.fillWidth: true
+                                visible: progress !== undefined && localFile == ""
+                                indeterminate: progress < 0
+                                value: progress >= 0 ? progress : 0
+                            }
+                            Button {
+                                text: localFile != "" ? "Open" : "Download"
+                                visible: localFile != "" || progress === undefined
+                                onClicked: {
+                                    if (localFile != "")
+                                        messageModel.openFile(index)
+                                    else
+                                        messageModel.downloadFile(index)
+                                }
+                            }
                         }
                         Loader {
                             asynchronous: true
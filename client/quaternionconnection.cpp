@@ -19,10 +19,439 @@
 
 #include "quaternionconnection.h"
 #include "quaternionroom.h"
+#include "statecache.h"
+#include "timelinestore.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSettings>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+static SyncBatch parseSyncResponse(const QJsonObject& response)
+{
+    using QMatrixClient::JoinState;
+    SyncBatch batch;
+    batch.nextBatch = response.value("next_batch").toString();
+
+    const QJsonObject rooms = response.value("rooms").toObject();
+    const struct { const char* key; JoinState state; } sections[] = {
+        { "join", JoinState::Join },
+        { "invite", JoinState::Invite },
+        { "leave", JoinState::Leave },
+    };
+    for (const auto& section: sections)
+    {
+        const QJsonObject roomsJson = rooms.value(section.key).toObject();
+        for (auto it = roomsJson.begin(); it != roomsJson.end(); ++it)
+            batch.rooms.append(QMatrixClient::SyncRoomData(
+                it.key(), section.state, it.value().toObject()));
+    }
+    return batch;
+}
+
+class ParseTask: public QRunnable
+{
+    public:
+        ParseTask(QuaternionConnection* connection, StateCache* cache, QByteArray data)
+            : m_connection(connection), m_cache(cache), m_data(data)
+        { }
+
+        void run() override
+        {
+            QElapsedTimer timer;
+            timer.start();
+            SyncBatch batch;
+            QJsonParseError error;
+            const QJsonObject response = QJsonDocument::fromJson(m_data, &error).object();
+            if (error.error != QJsonParseError::NoError || response.isEmpty())
+            {
+                batch.error = error.errorString();
+            }
+            else
+            {
+                batch = parseSyncResponse(response);
+                m_cache->update(response);
+            }
+            batch.parseTime = timer.elapsed();
+            QMetaObject::invokeMethod(m_connection, "syncParsed", Qt::QueuedConnection,
+                                      Q_ARG(SyncBatch, batch));
+        }
+
+    private:
+        QuaternionConnection* m_connection;
+        StateCache* m_cache;
+        QByteArray m_data;
+};
 
 QuaternionConnection::QuaternionConnection(QUrl server, QObject* parent)
     : QMatrixClient::Connection(server, parent)
+    , m_nam(new QNetworkAccessManager(this))
+    , m_syncReply(nullptr)
+    , m_syncReceiveTime(0)
+    , m_syncSize(0)
+    , m_processing(false)
+    , m_applyTime(0)
+    , m_sliceCount(0)
+    , m_filterReply(nullptr)
+    , m_filterFailed(false)
+    , m_pendingSyncTimeout(0)
+    , m_stateCache(nullptr)
+{
+    qRegisterMetaType<SyncBatch>();
+    // Responses must be applied in the order they came
+    m_pool.setMaxThreadCount(1);
+    m_sliceTime = qMax(1, QSettings().value("Sync/slice_ms", 5).toInt());
+    m_applyTimer.setSingleShot(true);
+    m_applyTimer.setInterval(0);
+    connect( &m_applyTimer, &QTimer::timeout, this, &QuaternionConnection::applySlice );
+    // Besides this, the state is saved when the connection is closed
+    int saveInterval = QSettings().value("Cache/save_interval", 300).toInt();
+    m_saveTimer.setInterval(qMax(10, saveInterval) * 1000);
+    connect( &m_saveTimer, &QTimer::timeout, this, &QuaternionConnection::saveState );
+    connect( this, &QMatrixClient::Connection::loggedOut, this, &QuaternionConnection::dropState );
+}
+
+QuaternionConnection::~QuaternionConnection()
+{
+    if (m_syncReply)
+    {
+        m_syncReply->disconnect(this);
+        m_syncReply->abort();
+    }
+    if (m_filterReply)
+    {
+        m_filterReply->disconnect(this);
+        m_filterReply->abort();
+    }
+    m_pool.clear();
+    m_pool.waitForDone();
+    delete m_stateCache;
+}
+
+void QuaternionConnection::sync(int timeout, bool catchUp)
+{
+    if (m_syncReply || m_processing)
+        return; // Already syncing
+
+    if (m_filterId.isEmpty() && !m_filterFailed && !catchUp)
+    {
+        m_pendingSyncTimeout = timeout;
+        registerFilter();
+        return;
+    }
+
+    QUrlQuery query;
+    if (timeout >= 0)
+        query.addQueryItem("timeout", QString::number(timeout));
+    if (!m_syncToken.isEmpty())
+        query.addQueryItem("since", m_syncToken);
+    if (catchUp)
+    {
+        const int limit = QSettings().value("Sync/catchup_timeline_limit", 100).toInt();
+        query.addQueryItem("filter", QString::fromUtf8(
+            QJsonDocument(filterDefinition(limit)).toJson(QJsonDocument::Compact)));
+    }
+    else if (!m_filterId.isEmpty())
+        query.addQueryItem("filter", m_filterId);
+    m_syncTimer.start();
+    m_syncReply = m_nam->get(makeRequest("/_matrix/client/r0/sync", query));
+    connect( m_syncReply, &QNetworkReply::finished, this, &QuaternionConnection::syncFinished );
+}
+
+void QuaternionConnection::syncFinished()
+{
+    QNetworkReply* reply = m_syncReply;
+    m_syncReply = nullptr;
+    reply->deleteLater();
+    if (reply->error() != QNetworkReply::NoError)
+    {
+        const int httpStatus =
+            reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        const QJsonObject json = QJsonDocument::fromJson(reply->readAll()).object();
+        int retryAfterMs = json.value("retry_after_ms").toInt();
+        if (retryAfterMs == 0 && reply->hasRawHeader("Retry-After"))
+            retryAfterMs = reply->rawHeader("Retry-After").toInt() * 1000;
+        const QString message = json.contains("error")
+            ? json.value("error").toString() : reply->errorString();
+        emit syncFailed(httpStatus, json.value("errcode").toString(),
+                        retryAfterMs, message);
+        return;
+    }
+
+    const QByteArray data = reply->readAll();
+    m_syncReceiveTime = m_syncTimer.elapsed();
+    m_syncSize = data.size();
+    m_processing = true;
+    m_pool.start(new ParseTask(this, stateCache(), data));
+}
+
+void QuaternionConnection::syncParsed(SyncBatch batch)
+{
+    if (!batch.error.isEmpty())
+    {
+        m_processing = false;
+        qWarning() << "Couldn't parse the sync response:" << batch.error;
+        emit syncFailed(200, QString(), 0, batch.error);
+        return;
+    }
+
+    m_syncToken = batch.nextBatch;
+    // Rooms the user is looking at or is about to look at go first
+    QList<QMatrixClient::SyncRoomData> queues[LowestPriority + 1];
+    for (const QMatrixClient::SyncRoomData& data: batch.rooms)
+        queues[applyPriority(data)].append(data);
+    m_applyQueue.clear();
+    for (const auto& queue: queues)
+        m_applyQueue += queue;
+
+    qDebug() << (m_filterId.isEmpty() ? "Unfiltered sync:" : "Filtered sync:")
+             << m_syncSize << "bytes received in" << m_syncReceiveTime
+             << "ms, parsed in" << batch.parseTime << "ms,"
+             << m_applyQueue.size() << "room(s) to update";
+    m_applyTime = 0;
+    m_sliceCount = 0;
+    applySlice();
+}
+
+void QuaternionConnection::applySlice()
+{
+    QElapsedTimer timer;
+    timer.start();
+    // At least one room per slice, however long it takes
+    while (!m_applyQueue.isEmpty())
+    {
+        QMatrixClient::SyncRoomData data = m_applyQueue.takeFirst();
+        applyRoomData(data);
+        if (timer.elapsed() >= m_sliceTime)
+            break;
+    }
+    m_applyTime += timer.elapsed();
+    ++m_sliceCount;
+
+    if (!m_applyQueue.isEmpty())
+    {
+        // Let the event loop handle input and painting before going on
+        m_applyTimer.start();
+        return;
+    }
+
+    m_processing = false;
+    qDebug() << "Sync applied in" << m_applyTime << "ms over"
+             << m_sliceCount << "slice(s)";
+    if (!m_saveTimer.isActive())
+        m_saveTimer.start();
+    emit syncDone();
+}
+
+void QuaternionConnection::applyRoomData(QMatrixClient::SyncRoomData& data)
+{
+    if (QMatrixClient::Room* room = provideRoom(data.roomId))
+    {
+        QuaternionRoom* r = static_cast<QuaternionRoom*>(room);
+        r->noteSyncTimeline(data.timelineLimited, data.timelinePrevBatch);
+        // The library keeps pointers to the events it gets, so duplicates
+        // can only be deleted before that
+        r->dropDuplicates(data.timeline);
+        room->updateData(data);
+    }
+}
+
+int QuaternionConnection::applyPriority(const QMatrixClient::SyncRoomData& data)
+{
+    QuaternionRoom* room = static_cast<QuaternionRoom*>(roomMap().value(data.roomId));
+    if (room && room->isShown())
+        return 0;
+    if (data.joinState == QMatrixClient::JoinState::Invite)
+        return 1;
+    if (data.highlightCount > 0 || (room && room->highlightCount() > 0))
+        return 2;
+    return LowestPriority;
+}
+
+QJsonObject QuaternionConnection::filterDefinition(int timelineLimit)
+{
+    // Only events the client shows or keeps room state from
+    QJsonArray roomEventTypes;
+    roomEventTypes << "m.room.message" << "m.room.member" << "m.room.name"
+                   << "m.room.aliases" << "m.room.canonical_alias" << "m.room.topic";
+    QJsonArray ephemeralTypes;
+    ephemeralTypes << "m.typing" << "m.receipt";
+    QJsonArray roomAccountDataTypes;
+    roomAccountDataTypes << "m.fully_read";
+    QJsonArray none;
+    none << "*";
+
+    QJsonObject state;
+    state.insert("types", roomEventTypes);
+    // Members are only sent for the senders of the events in the sync;
+    // full lists are loaded when a room is opened
+    state.insert("lazy_load_members", true);
+    QJsonObject timeline;
+    timeline.insert("types", roomEventTypes);
+    timeline.insert("limit", qMax(1, timelineLimit));
+    timeline.insert("lazy_load_members", true);
+    QJsonObject ephemeral;
+    ephemeral.insert("types", ephemeralTypes);
+    QJsonObject roomAccountData;
+    roomAccountData.insert("types", roomAccountDataTypes);
+    QJsonObject nothing;
+    nothing.insert("not_types", none);
+
+    QJsonObject room;
+    room.insert("state", state);
+    room.insert("timeline", timeline);
+    room.insert("ephemeral", ephemeral);
+    room.insert("account_data", roomAccountData);
+    QJsonObject filter;
+    filter.insert("room", room);
+    filter.insert("presence", nothing);
+    filter.insert("account_data", nothing);
+    return filter;
+}
+
+void QuaternionConnection::registerFilter()
+{
+    if (m_filterReply)
+        return;
+
+    const QByteArray definition =
+        QJsonDocument(filterDefinition(QSettings().value("Sync/timeline_limit", 20).toInt()))
+            .toJson(QJsonDocument::Compact);
+    const QString hash = QString::fromLatin1(
+        QCryptographicHash::hash(definition, QCryptographicHash::Sha1).toHex());
+    const QString settingsKey = "Sync/filters/" +
+        QString::fromLatin1(QUrl::toPercentEncoding(userId()));
+    const QStringList saved = QSettings().value(settingsKey).toStringList();
+    if (saved.size() == 2 && saved.at(0) == hash)
+    {
+        m_filterId = saved.at(1);
+        sync(m_pendingSyncTimeout);
+        return;
+    }
+
+    m_filterReply = m_nam->post(makeRequest(QString("/_matrix/client/r0/user/%1/filter")
+                                   .arg(QString::fromLatin1(QUrl::toPercentEncoding(userId())))),
+                                definition);
+    m_filterReply->setProperty("filterHash", hash);
+    m_filterReply->setProperty("settingsKey", settingsKey);
+    connect( m_filterReply, &QNetworkReply::finished, this, &QuaternionConnection::filterRegistered );
+}
+
+void QuaternionConnection::filterRegistered()
+{
+    QNetworkReply* reply = m_filterReply;
+    m_filterReply = nullptr;
+    reply->deleteLater();
+    m_filterId = QJsonDocument::fromJson(reply->readAll()).object()
+                    .value("filter_id").toString();
+    if (reply->error() != QNetworkReply::NoError || m_filterId.isEmpty())
+    {
+        // Syncing without a filter is slower, but still works
+        qWarning() << "Couldn't register the sync filter:" << reply->errorString();
+        m_filterId.clear();
+        m_filterFailed = true;
+    }
+    else
+    {
+        QSettings().setValue(reply->property("settingsKey").toString(),
+            QStringList() << reply->property("filterHash").toString() << m_filterId);
+    }
+    sync(m_pendingSyncTimeout);
+}
+
+StateCache* QuaternionConnection::stateCache()
+{
+    // The cache is per user, so it can only be made after logging in
+    if (!m_stateCache)
+        m_stateCache = new StateCache(userId());
+    return m_stateCache;
+}
+
+bool QuaternionConnection::loadState()
+{
+    if (!m_syncToken.isEmpty())
+        return false; // Already synced, the cache can only be older
+
+    QElapsedTimer timer;
+    timer.start();
+    const QJsonObject response = stateCache()->load();
+    if (response.isEmpty())
+        return false;
+
+    const qint64 readTime = timer.elapsed();
+    // This happens before the window is in use, so there's no point in
+    // slicing it
+    SyncBatch batch = parseSyncResponse(response);
+    m_syncToken = batch.nextBatch;
+    for (QMatrixClient::SyncRoomData& data: batch.rooms)
+        applyRoomData(data);
+    qDebug() << "Restored" << roomMap().size() << "room(s) from the state cache in"
+             << timer.elapsed() << "ms, of them" << readTime << "ms reading the file";
+    return true;
+}
+
+void QuaternionConnection::saveState()
+{
+    if (!m_stateCache || !m_stateCache->isDirty())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    if (m_stateCache->save())
+        qDebug() << "Saved the state cache in" << timer.elapsed() << "ms";
+}
+
+void QuaternionConnection::dropState()
+{
+    // Don't let a response that is still being parsed refill the cache
+    m_pool.clear();
+    m_pool.waitForDone();
+    m_applyTimer.stop();
+    m_applyQueue.clear();
+    m_processing = false;
+    m_saveTimer.stop();
+    m_syncToken.clear();
+    if (m_stateCache)
+        m_stateCache->clear();
+    // Message history doesn't stay on disk after logging out
+    TimelineStore::removeAll(userId());
+}
+
+QNetworkAccessManager* QuaternionConnection::nam() const
+{
+    return m_nam;
+}
+
+static QUrl makeUrl(QUrl baseUrl, const QString& path)
+{
+    QString basePath = baseUrl.path();
+    if (basePath.endsWith('/'))
+        basePath.chop(1);
+    baseUrl.setPath(basePath + path);
+    return baseUrl;
+}
+
+QNetworkRequest QuaternionConnection::makeRequest(const QString& apiPath,
+                                                  const QUrlQuery& query) const
+{
+    QUrl url = makeUrl(homeserver(), apiPath);
+    url.setQuery(query);
+    QNetworkRequest request(url);
+    if (!accessToken().isEmpty())
+        request.setRawHeader("Authorization", "Bearer " + accessToken().toLatin1());
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    return request;
+}
+
+QUrl QuaternionConnection::mediaUrl(const QUrl& mxcUrl) const
 {
+    return makeUrl(homeserver(), "/_matrix/media/r0/download/" +
+                   mxcUrl.host() + mxcUrl.path());
 }
 
 QMatrixClient::Room* QuaternionConnection::createRoom(QString roomId)
@@ -21,15 +21,128 @@
 #define QUATERNIONCONNECTION_H
 
 #include "lib/connection.h"
+#include "lib/jobs/syncjob.h"
+
+#include <QtCore/QUrlQuery>
+#include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThreadPool>
+#include <QtNetwork/QNetworkRequest>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class StateCache;
+
+/**
+ * A sync response turned into room updates, as produced by the parsing
+ * step on the worker thread
+ */
+struct SyncBatch
+{
+    QString nextBatch;
+    QList<QMatrixClient::SyncRoomData> rooms;
+    qint64 parseTime;
+    QString error;
+};
+Q_DECLARE_METATYPE(SyncBatch)
 
 class QuaternionConnection: public QMatrixClient::Connection
 {
         Q_OBJECT
     public:
         QuaternionConnection(QUrl server, QObject* parent = nullptr);
+        virtual ~QuaternionConnection();
+
+        /**
+         * Requests the changes since the last sync, like Connection::sync()
+         * does, but keeps track of the sync token here, so that it can be
+         * restored from the state cache. Emits syncDone() or syncFailed()
+         * when finished.
+         *
+         * Syncs use a filter registered on the server (see
+         * registerFilter()); the first sync waits for it. A catch-up sync
+         * uses a one-off filter with "Sync/catchup_timeline_limit" (100 by
+         * default) events per room instead, to fill fewer gaps after a long
+         * time offline.
+         *
+         * Responses are parsed, and the state cache updated, on a worker
+         * thread; only applying the prepared room updates happens on the
+         * GUI thread. That is done in slices of "Sync/slice_ms" (5 by
+         * default), the shown room first, then invites and rooms with
+         * highlights; syncDone() is emitted once all rooms are updated and
+         * no new sync is started before that.
+         */
+        void sync(int timeout = -1, bool catchUp = false);
+
+        /**
+         * Restores rooms from the state cache, if there is one.
+         * Should be called before the first sync; returns whether anything
+         * was restored.
+         */
+        bool loadState();
+        /** Writes the state cache to disk if it has changed */
+        void saveState();
+
+        /**
+         * Network access for client-side requests that libqmatrixclient
+         * doesn't provide jobs for (media transfers, room directory etc.)
+         */
+        QNetworkAccessManager* nam() const;
+        QNetworkRequest makeRequest(const QString& apiPath,
+                                    const QUrlQuery& query = QUrlQuery()) const;
+        /** Converts an mxc:// URI to a download URL on the homeserver */
+        QUrl mediaUrl(const QUrl& mxcUrl) const;
+
+    signals:
+        /**
+         * A sync request failed. httpStatus is 0 if the server couldn't be
+         * reached; errcode and retryAfterMs come from the Matrix error
+         * response, if there was one.
+         */
+        void syncFailed(int httpStatus, const QString& errcode,
+                        int retryAfterMs, const QString& message);
 
     protected:
         virtual QMatrixClient::Room* createRoom(QString roomId);
+
+    private slots:
+        void syncFinished();
+        void syncParsed(SyncBatch batch);
+        void applySlice();
+        void filterRegistered();
+        void dropState();
+
+    private:
+        QNetworkAccessManager* m_nam;
+        QNetworkReply* m_syncReply;
+        QString m_syncToken;
+        QElapsedTimer m_syncTimer;
+        qint64 m_syncReceiveTime;
+        int m_syncSize;
+        QThreadPool m_pool;
+        bool m_processing; // Parsing or applying a sync response
+        QList<QMatrixClient::SyncRoomData> m_applyQueue;
+        QTimer m_applyTimer;
+        int m_sliceTime;
+        qint64 m_applyTime;
+        int m_sliceCount;
+        QString m_filterId;
+        QNetworkReply* m_filterReply;
+        bool m_filterFailed;
+        int m_pendingSyncTimeout;
+        StateCache* m_stateCache;
+        QTimer m_saveTimer;
+
+        void applyRoomData(QMatrixClient::SyncRoomData& data);
+        enum { LowestPriority = 3 };
+        int applyPriority(const QMatrixClient::SyncRoomData& data);
+        /**
+         * Uploads the sync filter unless the server already has the same
+         * one from a previous session
+         */
+        void registerFilter();
+        static QJsonObject filterDefinition(int timelineLimit);
+        StateCache* stateCache();
 };
 
 #endif // QUATERNIONCONNECTION_H
@@ -20,14 +20,48 @@
 #include "quaternionroom.h"
 
 #include "message.h"
+#include "sortedmemberlist.h"
+#include "membersearchindex.h"
+#include "completionindex.h"
+#include "timelinestore.h"
+#include "quaternionconnection.h"
 #include "lib/events/event.h"
+#include "lib/events/roommessageevent.h"
 #include "lib/connection.h"
 
 #include <QtCore/QDebug>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSettings>
+#include <QtCore/QUrl>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+static const int PreviousContentLimit = 50;
+static const int GapRetryInterval = 5000;
 
 QuaternionRoom::QuaternionRoom(QMatrixClient::Connection* connection, QString roomId)
     : QMatrixClient::Room(connection, roomId)
+    , m_sortedMembers(nullptr)
+    , m_memberSearchIndex(nullptr)
+    , m_completionIndex(nullptr)
+    , m_hydrated(false)
+    , m_timelineStore(new TimelineStore(connection->userId(), roomId))
+    , m_newestStored(TimelineStore::NoPosition)
+    , m_oldestStored(TimelineStore::NoPosition)
+    , m_servedFromStore(false)
+    , m_atTimelineStart(false)
+    , m_previousContentReply(nullptr)
+    , m_membersRequested(false)
+    , m_receiptReply(nullptr)
 {
+    m_receiptTimer.setSingleShot(true);
+    m_receiptTimer.setInterval(QSettings().value("UI/receipt_interval_ms", 2000).toInt());
+    connect( &m_receiptTimer, &QTimer::timeout, this, &QuaternionRoom::sendReceipt );
+    m_gapRetryTimer.setSingleShot(true);
+    m_gapRetryTimer.setInterval(GapRetryInterval);
+    connect( &m_gapRetryTimer, &QTimer::timeout, this, &QuaternionRoom::retryGaps );
     m_shown = false;
     m_unreadMessages = false;
     m_cachedInput = "";
@@ -36,11 +70,40 @@ QuaternionRoom::QuaternionRoom(QMatrixClient::Connection* connection, QString ro
 }
 
 QuaternionRoom::~QuaternionRoom()
-{ }
+{
+    if (m_previousContentReply)
+    {
+        m_previousContentReply->disconnect(this);
+        m_previousContentReply->abort();
+    }
+    for (QNetworkReply* reply: m_gapReplies)
+    {
+        reply->disconnect(this);
+        reply->abort();
+    }
+    if (m_receiptReply)
+    {
+        m_receiptReply->disconnect(this);
+        m_receiptReply->abort();
+    }
+    delete m_timelineStore;
+}
 
 void QuaternionRoom::lookAt()
 {
-    markMessagesAsRead();
+    // This is called on any user activity, so it has to be cheap
+    if (!messageEvents().isEmpty())
+    {
+        const QString eventId = messageEvents().back()->id();
+        if (eventId != m_pendingReceipt && eventId != m_sentReceipt
+                && eventId != lastReadEvent(connection()->user()))
+        {
+            promoteReadMarker(connection()->user(), eventId);
+            m_pendingReceipt = eventId;
+            if (!m_receiptTimer.isActive())
+                m_receiptTimer.start();
+        }
+    }
     if( m_unreadMessages )
     {
         m_unreadMessages = false;
@@ -66,11 +129,149 @@ bool QuaternionRoom::isShown()
     return m_shown;
 }
 
+void QuaternionRoom::hydrate()
+{
+    if (m_hydrated)
+        return;
+    m_hydrated = true;
+
+    const auto& events = messageEvents();
+    m_messages.reserve(events.size() + m_gaps.size());
+    for (auto e: events)
+    {
+        if (m_gaps.contains(e->id()))
+            m_messages.push_back(new Message(m_gaps.value(e->id()), e->timestamp()));
+        m_messages.push_back(makeMessage(e));
+    }
+    m_gaps.clear();
+    qDebug() << "Hydrated" << displayName() << "with" << m_messages.size() << "message(s)";
+}
+
+bool QuaternionRoom::isHydrated() const
+{
+    return m_hydrated;
+}
+
 const QuaternionRoom::Timeline& QuaternionRoom::messages() const
 {
+    Q_ASSERT(m_hydrated);
     return m_messages;
 }
 
+QString QuaternionRoom::lastMessageSummary() const
+{
+    return m_lastMessageSummary;
+}
+
+SortedMemberList* QuaternionRoom::sortedMembers()
+{
+    if (!m_sortedMembers)
+        m_sortedMembers = new SortedMemberList(this);
+    return m_sortedMembers;
+}
+
+MemberSearchIndex* QuaternionRoom::memberSearchIndex()
+{
+    if (!m_memberSearchIndex)
+        m_memberSearchIndex = new MemberSearchIndex(this);
+    return m_memberSearchIndex;
+}
+
+CompletionIndex* QuaternionRoom::completionIndex()
+{
+    if (!m_completionIndex)
+    {
+        m_completionIndex = new CompletionIndex(this);
+        // Later messages will be noted as they arrive
+        for (auto e: messageEvents())
+            noteActivity(e);
+    }
+    return m_completionIndex;
+}
+
+void QuaternionRoom::noteActivity(QMatrixClient::Event* e)
+{
+    if (m_completionIndex && e->type() == QMatrixClient::EventType::RoomMessage)
+        m_completionIndex->noteActivity(e->senderId(), e->timestamp().toMSecsSinceEpoch());
+}
+
+const QList<PendingEvent>& QuaternionRoom::pendingEvents() const
+{
+    return m_pendingEvents;
+}
+
+void QuaternionRoom::addPendingEvent(const PendingEvent& pending)
+{
+    emit pendingEventAboutToAdd();
+    m_pendingEvents.append(pending);
+    emit pendingEventAdded();
+}
+
+void QuaternionRoom::updatePendingEvent(const QString& txnId,
+                                        PendingEvent::Status status, qreal progress)
+{
+    int i = findPendingEvent(txnId);
+    if (i == -1)
+        return;
+    m_pendingEvents[i].status = status;
+    m_pendingEvents[i].progress = progress;
+    emit pendingEventChanged(i);
+}
+
+void QuaternionRoom::setPendingLocalFile(const QString& txnId, const QString& localFile)
+{
+    int i = findPendingEvent(txnId);
+    if (i == -1)
+        return;
+    m_pendingEvents[i].localFile = localFile;
+    emit pendingEventChanged(i);
+}
+
+void QuaternionRoom::removePendingEvent(const QString& txnId)
+{
+    int i = findPendingEvent(txnId);
+    if (i == -1)
+        return;
+    emit pendingEventAboutToRemove(i);
+    m_pendingEvents.removeAt(i);
+    emit pendingEventRemoved();
+}
+
+void QuaternionRoom::retryPendingEvent(const QString& txnId)
+{
+    int i = findPendingEvent(txnId);
+    if (i != -1 && m_pendingEvents.at(i).status == PendingEvent::Failed)
+        emit pendingEventRetryRequested(txnId);
+}
+
+void QuaternionRoom::discardPendingEvent(const QString& txnId)
+{
+    int i = findPendingEvent(txnId);
+    if (i != -1 && m_pendingEvents.at(i).status == PendingEvent::Failed)
+        emit pendingEventDiscardRequested(txnId);
+}
+
+int QuaternionRoom::findPendingEvent(const QString& txnId) const
+{
+    for (int i = 0; i < m_pendingEvents.size(); ++i)
+        if (m_pendingEvents.at(i).txnId == txnId)
+            return i;
+    return -1;
+}
+
+void QuaternionRoom::checkPendingEcho(QMatrixClient::Event* e)
+{
+    // The transaction id is only sent back to the device that sent the event
+    auto unsignedData = QJsonDocument::fromJson(e->originalJson().toUtf8())
+                            .object().value("unsigned").toObject();
+    QString txnId = unsignedData.value("transaction_id").toString();
+    // We're in the middle of inserting messages, so the pending row
+    // can only be removed afterwards
+    if (!txnId.isEmpty())
+        QMetaObject::invokeMethod(this, "removePendingEvent", Qt::QueuedConnection,
+                                  Q_ARG(QString, txnId));
+}
+
 bool QuaternionRoom::hasUnreadMessages()
 {
     return m_unreadMessages;
@@ -81,23 +282,74 @@ inline Message* QuaternionRoom::makeMessage(QMatrixClient::Event* e)
     return new Message(connection(), e, this);
 }
 
+void QuaternionRoom::dropDuplicates(QMatrixClient::Events& events)
+{
+    QMatrixClient::Events fresh;
+    int duplicates = 0;
+    for (auto e: events)
+    {
+        if (m_eventIds.contains(e->id()))
+        {
+            delete e;
+            ++duplicates;
+            continue;
+        }
+        m_eventIds.insert(e->id());
+        fresh.push_back(e);
+    }
+    if (duplicates > 0)
+        qDebug() << "Dropped" << duplicates << "duplicate event(s) in" << displayName();
+    events = fresh;
+}
+
 void QuaternionRoom::doAddNewMessageEvents(const QMatrixClient::Events& events)
 {
+    // Duplicates are dropped before the library gets the events, by
+    // QuaternionConnection::applyRoomData() and addHistoricalEvents()
+    storeNewEvents(events);
+    const bool hadEvents = !messageEvents().isEmpty();
+    const QString gapToken = m_gapToken;
+    m_gapToken.clear();
+    if (events.isEmpty())
+        return;
     Room::doAddNewMessageEvents(events);
 
-    m_messages.reserve(m_messages.size() + events.size());
+    // A limited batch doesn't continue from the messages we have
+    const bool gap = hadEvents && !gapToken.isEmpty();
+    if (gap && !m_hydrated)
+        m_gaps.insert(events.front()->id(), gapToken);
+    if (m_hydrated)
+    {
+        const int first = m_messages.size();
+        emit aboutToInsertMessages(first, first + events.size() - (gap ? 0 : 1));
+        m_messages.reserve(m_messages.size() + events.size() + 1);
+        if (gap)
+            m_messages.push_back(new Message(gapToken, events.front()->timestamp()));
+        for (auto e: events)
+            m_messages.push_back(makeMessage(e));
+        emit insertedMessages();
+    }
+
     bool new_message = false;
     QMatrixClient::Event* lastOwnMessage = nullptr;
+    bool activityChanged = false;
     for (auto e: events)
     {
-        m_messages.push_back(makeMessage(e));
+        noteActivity(e);
+        activityChanged |= updateLastActivity(e);
         if (e->senderId() == connection()->userId())
+        {
             lastOwnMessage = e;
+            if (!m_pendingEvents.isEmpty())
+                checkPendingEcho(e);
+        }
         else if (e->type() == QMatrixClient::EventType::RoomMessage)
             new_message = true;
     }
     if (lastOwnMessage)
         promoteReadMarker(connection()->user(), lastOwnMessage->id());
+    if (activityChanged)
+        emit lastActivityChanged(this);
 
     if( !m_unreadMessages && new_message)
     {
@@ -109,11 +361,350 @@ void QuaternionRoom::doAddNewMessageEvents(const QMatrixClient::Events& events)
 
 void QuaternionRoom::doAddHistoricalMessageEvents(const QMatrixClient::Events& events)
 {
+    storeHistoricalEvents(events);
+    if (events.isEmpty())
+        return;
     Room::doAddHistoricalMessageEvents(events);
 
-    m_messages.reserve(m_messages.size() + events.size());
+    if (m_hydrated)
+    {
+        emit aboutToInsertMessages(0, events.size() - 1);
+        m_messages.reserve(m_messages.size() + events.size());
+        for (auto e: events)
+            m_messages.push_front(makeMessage(e));
+        emit insertedMessages();
+    }
+    bool activityChanged = false;
     for (auto e: events)
-        m_messages.push_front(makeMessage(e));
+    {
+        noteActivity(e);
+        activityChanged |= updateLastActivity(e);
+    }
+    if (activityChanged)
+        emit lastActivityChanged(this);
+}
+
+void QuaternionRoom::noteSyncTimeline(bool limited, const QString& prevBatch)
+{
+    if (limited)
+    {
+        m_newestStored = TimelineStore::NoPosition; // Don't link across the gap
+        m_gapToken = prevBatch;
+    }
+    m_syncPrevBatch = prevBatch;
+    if (m_prevBatch.isEmpty() && !m_atTimelineStart)
+        m_prevBatch = prevBatch;
+}
+
+void QuaternionRoom::storeNewEvents(const QMatrixClient::Events& events)
+{
+    for (auto e: events)
+    {
+        const QByteArray json = e->originalJson().toUtf8();
+        // Events restored from the state cache are usually stored already
+        qint64 pos = m_timelineStore->find(e->id());
+        if (pos == TimelineStore::NoPosition && m_newestStored != TimelineStore::NoPosition)
+            pos = m_timelineStore->appendAfter(m_newestStored, e->id(), json);
+        if (pos == TimelineStore::NoPosition)
+        {
+            // The sync token only points right before the first event
+            pos = m_timelineStore->startSegment(e->id(), json,
+                e == events.front() ? m_syncPrevBatch : QString());
+        }
+        m_newestStored = pos;
+    }
+    m_syncPrevBatch.clear();
+    m_timelineStore->close();
+}
+
+void QuaternionRoom::storeHistoricalEvents(const QMatrixClient::Events& events)
+{
+    // Historical events come newest first
+    for (auto e: events)
+    {
+        const QByteArray json = e->originalJson().toUtf8();
+        qint64 pos = m_timelineStore->find(e->id());
+        if (pos == TimelineStore::NoPosition && m_oldestStored != TimelineStore::NoPosition)
+            pos = m_timelineStore->prependBefore(m_oldestStored, e->id(), json);
+        if (pos == TimelineStore::NoPosition)
+            pos = m_timelineStore->startSegment(e->id(), json);
+        m_oldestStored = pos;
+    }
+    m_timelineStore->close();
+}
+
+void QuaternionRoom::storeGapEvents(const QMatrixClient::Events& events,
+                                    int gapIndex, const QString& token)
+{
+    // Gap events (newest first) go in front of the batch that followed the
+    // gap; the segment it started then begins with them
+    qint64 pos = TimelineStore::NoPosition;
+    if (gapIndex + 1 < m_messages.size() && !m_messages.at(gapIndex + 1)->isGap())
+        pos = m_timelineStore->find(m_messages.at(gapIndex + 1)->messageEvent()->id());
+    for (auto e: events)
+    {
+        const QByteArray json = e->originalJson().toUtf8();
+        qint64 next = m_timelineStore->find(e->id());
+        if (next == TimelineStore::NoPosition && pos != TimelineStore::NoPosition)
+            next = m_timelineStore->prependBefore(pos, e->id(), json);
+        if (next == TimelineStore::NoPosition)
+            next = m_timelineStore->startSegment(e->id(), json);
+        pos = next;
+    }
+    if (!events.isEmpty() && !token.isEmpty())
+        m_timelineStore->setSegmentToken(pos, token);
+    m_timelineStore->close();
+}
+
+void QuaternionRoom::addHistoricalEvents(QMatrixClient::Events events)
+{
+    dropDuplicates(events);
+    emit aboutToAddHistoricalMessages(events);
+    doAddHistoricalMessageEvents(events);
+    emit addedMessages();
+}
+
+void QuaternionRoom::getPreviousContent()
+{
+    if (m_previousContentReply || m_atTimelineStart)
+        return;
+
+    if (!messageEvents().isEmpty())
+    {
+        if (m_oldestStored == TimelineStore::NoPosition)
+        {
+            m_oldestStored = m_timelineStore->find(messageEvents().front()->id());
+            m_timelineStore->close();
+        }
+        if (m_oldestStored != TimelineStore::NoPosition)
+        {
+            QJsonArray chunk =
+                m_timelineStore->readBefore(m_oldestStored, PreviousContentLimit);
+            m_timelineStore->close();
+            if (!chunk.isEmpty())
+            {
+                qDebug() << "Loaded" << chunk.size() << "previous event(s) of"
+                         << displayName() << "from the timeline store";
+                m_servedFromStore = true;
+                addHistoricalEvents(QMatrixClient::eventsFromJson(chunk));
+                return;
+            }
+            // The store ran out; the server continues from its earliest event
+            QString token = m_timelineStore->segmentToken(m_oldestStored);
+            if (!token.isEmpty())
+                m_prevBatch = token;
+            else if (m_servedFromStore)
+            {
+                qWarning() << "Can't continue the history of" << displayName()
+                           << "from the server: no pagination token in the store";
+                return;
+            }
+        }
+    }
+    if (m_prevBatch.isEmpty())
+    {
+        if (!m_servedFromStore)
+            Room::getPreviousContent();
+        return;
+    }
+    requestPreviousContent();
+}
+
+void QuaternionRoom::loadMembers()
+{
+    if (m_membersRequested)
+        return;
+    m_membersRequested = true;
+
+    QuaternionConnection* c = static_cast<QuaternionConnection*>(connection());
+    QNetworkReply* reply = c->nam()->get(c->makeRequest(
+        QString("/_matrix/client/r0/rooms/%1/members")
+            .arg(QString::fromLatin1(QUrl::toPercentEncoding(id())))));
+    connect( reply, &QNetworkReply::finished, this, [=] {
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError)
+        {
+            qWarning() << "Couldn't load the members of" << displayName()
+                       << ":" << reply->errorString();
+            m_membersRequested = false; // Try again next time
+            return;
+        }
+        const QJsonArray chunk = QJsonDocument::fromJson(reply->readAll())
+                                    .object().value("chunk").toArray();
+        QMatrixClient::Events events = QMatrixClient::eventsFromJson(chunk);
+        qDebug() << "Loaded" << events.size() << "member(s) of" << displayName();
+        // Members already known get their (same) state applied again,
+        // which doesn't emit anything
+        processStateEvents(events);
+        qDeleteAll(events);
+    });
+}
+
+void QuaternionRoom::requestPreviousContent()
+{
+    QuaternionConnection* c = static_cast<QuaternionConnection*>(connection());
+    QUrlQuery query;
+    query.addQueryItem("from", m_prevBatch);
+    query.addQueryItem("dir", "b");
+    query.addQueryItem("limit", QString::number(PreviousContentLimit));
+    m_previousContentReply = c->nam()->get(c->makeRequest(
+        QString("/_matrix/client/r0/rooms/%1/messages")
+            .arg(QString::fromLatin1(QUrl::toPercentEncoding(id()))), query));
+    connect( m_previousContentReply, &QNetworkReply::finished, this, [=] {
+        QNetworkReply* reply = m_previousContentReply;
+        m_previousContentReply = nullptr;
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError)
+        {
+            qWarning() << "Couldn't load previous messages of" << displayName()
+                       << ":" << reply->errorString();
+            return;
+        }
+        const QJsonObject json = QJsonDocument::fromJson(reply->readAll()).object();
+        const QJsonArray chunk = json.value("chunk").toArray();
+        const QString end = json.value("end").toString();
+        if (chunk.isEmpty())
+        {
+            m_atTimelineStart = true;
+            return;
+        }
+        addHistoricalEvents(QMatrixClient::eventsFromJson(chunk));
+        m_prevBatch = end;
+        if (m_oldestStored != TimelineStore::NoPosition)
+        {
+            m_timelineStore->setSegmentToken(m_oldestStored, end);
+            m_timelineStore->close();
+        }
+    });
+}
+
+void QuaternionRoom::fillGap(int index)
+{
+    if (!m_hydrated || index < 0 || index >= m_messages.size() ||
+            !m_messages.at(index)->isGap())
+        return;
+
+    Message* gap = m_messages.at(index);
+    if (m_gapReplies.contains(gap))
+        return;
+    m_failedGaps.removeOne(gap);
+    QuaternionConnection* c = static_cast<QuaternionConnection*>(connection());
+    QUrlQuery query;
+    query.addQueryItem("from", gap->gapToken());
+    query.addQueryItem("dir", "b");
+    query.addQueryItem("limit", QString::number(PreviousContentLimit));
+    QNetworkReply* reply = c->nam()->get(c->makeRequest(
+        QString("/_matrix/client/r0/rooms/%1/messages")
+            .arg(QString::fromLatin1(QUrl::toPercentEncoding(id()))), query));
+    m_gapReplies.insert(gap, reply);
+    connect( reply, &QNetworkReply::finished, this, [=] {
+        m_gapReplies.remove(gap);
+        reply->deleteLater();
+        // Older messages may have been added above the gap meanwhile
+        const int gapIndex = m_messages.indexOf(gap);
+        if (gapIndex == -1)
+            return;
+        if (reply->error() != QNetworkReply::NoError)
+        {
+            qWarning() << "Couldn't load missed messages of" << displayName()
+                       << ":" << reply->errorString();
+            if (!m_failedGaps.contains(gap))
+                m_failedGaps.push_back(gap);
+            if (!m_gapRetryTimer.isActive())
+                m_gapRetryTimer.start();
+            return;
+        }
+        const QJsonObject json = QJsonDocument::fromJson(reply->readAll()).object();
+        const QString end = json.value("end").toString();
+        // The events come newest first; the first one we have already is
+        // where the gap ends. Without an end token there's nothing more
+        // to load, but the events that came are still kept.
+        QMatrixClient::Events events =
+            QMatrixClient::eventsFromJson(json.value("chunk").toArray());
+        bool closed = events.isEmpty() || end.isEmpty();
+        bool met = false;
+        QMatrixClient::Events fresh;
+        for (auto e: events)
+        {
+            if (met || m_eventIds.contains(e->id()))
+            {
+                met = closed = true;
+                delete e;
+                continue;
+            }
+            m_eventIds.insert(e->id());
+            fresh.push_back(e);
+        }
+        storeGapEvents(fresh, gapIndex, end);
+
+        if (!fresh.isEmpty())
+        {
+            emit aboutToInsertMessages(gapIndex + 1, gapIndex + fresh.size());
+            for (auto e: fresh)
+            {
+                m_gapEvents.push_back(e);
+                m_messages.insert(gapIndex + 1, makeMessage(e));
+                noteActivity(e);
+            }
+            emit insertedMessages();
+        }
+        qDebug() << "Loaded" << fresh.size() << "missed message(s) of" << displayName()
+                 << (closed ? "- the gap is closed" : "");
+        if (closed)
+        {
+            emit aboutToRemoveMessages(gapIndex, gapIndex);
+            delete m_messages.takeAt(gapIndex);
+            emit removedMessages();
+        }
+        else
+        {
+            gap->setGapToken(end);
+            emit gapChanged(gapIndex);
+        }
+    });
+}
+
+void QuaternionRoom::retryGaps()
+{
+    // Gaps only go away in fillGap(), after their request is done
+    const QList<Message*> gaps = m_failedGaps;
+    for (Message* gap: gaps)
+        fillGap(m_messages.indexOf(gap));
+}
+
+void QuaternionRoom::sendReceipt()
+{
+    if (m_pendingReceipt.isEmpty() || m_pendingReceipt == m_sentReceipt)
+        return;
+
+    // A newer receipt makes the one being sent useless
+    if (m_receiptReply)
+    {
+        m_receiptReply->disconnect(this);
+        m_receiptReply->abort();
+        m_receiptReply->deleteLater();
+    }
+    const QString eventId = m_pendingReceipt;
+    QuaternionConnection* c = static_cast<QuaternionConnection*>(connection());
+    m_receiptReply = c->nam()->post(c->makeRequest(
+        QString("/_matrix/client/r0/rooms/%1/receipt/m.read/%2")
+            .arg(QString::fromLatin1(QUrl::toPercentEncoding(id())),
+                 QString::fromLatin1(QUrl::toPercentEncoding(eventId)))), "{}");
+    connect( m_receiptReply, &QNetworkReply::finished, this, [=] {
+        QNetworkReply* reply = m_receiptReply;
+        m_receiptReply = nullptr;
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError)
+        {
+            // Sent again with the next lookAt()
+            qWarning() << "Couldn't send a read receipt to" << displayName()
+                       << ":" << reply->errorString();
+            if (m_pendingReceipt == eventId)
+                m_pendingReceipt.clear();
+            return;
+        }
+        m_sentReceipt = eventId;
+    });
 }
 
 void QuaternionRoom::processEphemeralEvent(QMatrixClient::Event* event)
@@ -139,6 +730,28 @@ void QuaternionRoom::processEphemeralEvent(QMatrixClient::Event* event)
     }
 }
 
+QDateTime QuaternionRoom::lastActivity() const
+{
+    return m_lastActivity;
+}
+
+bool QuaternionRoom::updateLastActivity(QMatrixClient::Event* e)
+{
+    if (e->type() != QMatrixClient::EventType::RoomMessage)
+        return false;
+    // Historical messages may still be newer if the timeline was empty
+    if (m_lastActivity.isValid() && e->timestamp() <= m_lastActivity)
+        return false;
+    m_lastActivity = e->timestamp();
+    auto messageEvent = static_cast<QMatrixClient::RoomMessageEvent*>(e);
+    QString body = messageEvent->plainBody();
+    if (body.size() > 80)
+        body = body.left(80) + QChar(0x2026); // Ellipsis
+    m_lastMessageSummary = QString("%1: %2")
+        .arg(roomMembername(messageEvent->senderId()), body);
+    return true;
+}
+
 void QuaternionRoom::countChanged()
 {
     if( m_shown )
@@ -22,7 +22,33 @@
 
 #include "lib/room.h"
 
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+
 class Message;
+class SortedMemberList;
+class MemberSearchIndex;
+class CompletionIndex;
+class TimelineStore;
+class QNetworkReply;
+
+/**
+ * An outgoing event that the server hasn't echoed back yet
+ */
+struct PendingEvent
+{
+    enum Status { Queued, Preparing, Uploading, Sending, Sent, Failed };
+
+    QString txnId;
+    QString msgType;
+    QString body;
+    QString localFile; // An image to show while uploading
+    QDateTime timestamp;
+    Status status;
+    qreal progress; // In range [0, 1], or -1 if unknown
+};
 
 class QuaternionRoom: public QMatrixClient::Room
 {
@@ -39,20 +65,98 @@ class QuaternionRoom: public QMatrixClient::Room
          * This is used to mark messages as read.
          */
         void setShown(bool shown);
+        /**
+         * Marks the messages as read. The read marker moves right away;
+         * the receipt is sent at most once per "UI/receipt_interval_ms"
+         * (2000 by default), for the latest message by then.
+         */
         void lookAt();
         bool isShown();
 
         void setCachedInput(const QString& input);
         const QString& cachedInput() const;
 
+        /**
+         * Message wrappers are only built for rooms that have been shown
+         * (hydrated); other rooms only keep their counters and a summary
+         * of the latest message. Call hydrate() before using messages().
+         */
+        void hydrate();
+        bool isHydrated() const;
         const Timeline& messages() const;
+        /** "Sender: text" of the latest message, available without hydration */
+        QString lastMessageSummary() const;
+
+        /**
+         * Loads older messages: from the local timeline store while it has
+         * them, then from the server
+         */
+        void getPreviousContent();
+        /**
+         * Requests the full member list; syncs only bring the members
+         * needed to show the timeline. Does nothing after the first call.
+         */
+        void loadMembers();
+
+        /**
+         * Called by the connection before applying a timeline batch from
+         * /sync. A limited batch leaves a gap between the messages already
+         * loaded and the new ones; it shows as a gap row in messages().
+         */
+        void noteSyncTimeline(bool limited, const QString& prevBatch);
+        /**
+         * Removes and deletes the events that are already in the timeline.
+         * Must be called before the events are handed to the library.
+         */
+        void dropDuplicates(QMatrixClient::Events& events);
+        /**
+         * Loads the messages missing at the gap row at the given index of
+         * messages(). The gap closes once the loaded messages meet ones
+         * that are already there. Each gap has at most one request in
+         * flight; failed ones are requested again after a while.
+         */
+        void fillGap(int index);
+
+        /** Members sorted by name; built on the first call and kept up to date */
+        SortedMemberList* sortedMembers();
+        /** Prefix search over members; built on the first call and kept up to date */
+        MemberSearchIndex* memberSearchIndex();
+        /** Nick completion candidates; built on the first call and kept up to date */
+        CompletionIndex* completionIndex();
+
+        const QList<PendingEvent>& pendingEvents() const;
+        void addPendingEvent(const PendingEvent& pending);
+        void updatePendingEvent(const QString& txnId, PendingEvent::Status status,
+                                qreal progress = -1);
+        void setPendingLocalFile(const QString& txnId, const QString& localFile);
+        Q_INVOKABLE void removePendingEvent(const QString& txnId);
+        /**
+         * Ask whoever sends a failed pending event to try again or to
+         * give up on it; they are told with the signals below.
+         */
+        void retryPendingEvent(const QString& txnId);
+        void discardPendingEvent(const QString& txnId);
 
         bool hasUnreadMessages();
+        /** Time of the latest message in the loaded timeline */
+        QDateTime lastActivity() const;
 
     signals:
+        /** Changes of messages(), which only happen for hydrated rooms */
         void aboutToInsertMessages(size_type from, size_type to);
         void insertedMessages();
+        void aboutToRemoveMessages(size_type from, size_type to);
+        void removedMessages();
+        void gapChanged(size_type index);
         void unreadMessagesChanged(QuaternionRoom* room);
+        void lastActivityChanged(QuaternionRoom* room);
+        void pendingEventAboutToAdd();
+        void pendingEventAdded();
+        void pendingEventChanged(int pendingIndex);
+        void pendingEventAboutToRemove(int pendingIndex);
+        void pendingEventRemoved();
+        void pendingEventRetryRequested(const QString& txnId);
+        void pendingEventDiscardRequested(const QString& txnId);
 
     protected:
         virtual void doAddNewMessageEvents(const QMatrixClient::Events& events) override;
@@ -61,14 +165,53 @@ class QuaternionRoom: public QMatrixClient::Room
 
     private slots:
         void countChanged();
+        void sendReceipt();
+        void retryGaps();
 
     private:
         Timeline m_messages;
+        QList<PendingEvent> m_pendingEvents;
+        SortedMemberList* m_sortedMembers;
+        MemberSearchIndex* m_memberSearchIndex;
+        CompletionIndex* m_completionIndex;
         bool m_shown;
         bool m_unreadMessages;
         QString m_cachedInput;
+        QDateTime m_lastActivity;
+        QString m_lastMessageSummary;
+        bool m_hydrated;
+        TimelineStore* m_timelineStore;
+        qint64 m_newestStored; // Positions in the store
+        qint64 m_oldestStored;
+        QString m_syncPrevBatch; // For the next sync batch
+        QString m_prevBatch; // To get messages before the oldest one from the server
+        bool m_servedFromStore;
+        bool m_atTimelineStart;
+        QNetworkReply* m_previousContentReply;
+        bool m_membersRequested;
+        QSet<QString> m_eventIds; // Of all events in the timeline
+        QString m_gapToken; // Set by a limited sync batch
+        QHash<QString, QString> m_gaps; // Gap tokens by the event after the gap, until hydrated
+        QMatrixClient::Owning<QMatrixClient::Events> m_gapEvents;
+        QHash<Message*, QNetworkReply*> m_gapReplies; // One in flight per gap row
+        QList<Message*> m_failedGaps; // To request again on m_gapRetryTimer
+        QTimer m_gapRetryTimer;
+        QTimer m_receiptTimer;
+        QString m_pendingReceipt; // Event to send a receipt for
+        QString m_sentReceipt;
+        QNetworkReply* m_receiptReply;
 
         Message* makeMessage(QMatrixClient::Event* e);
+        int findPendingEvent(const QString& txnId) const;
+        void checkPendingEcho(QMatrixClient::Event* e);
+        void noteActivity(QMatrixClient::Event* e);
+        bool updateLastActivity(QMatrixClient::Event* e);
+        void storeNewEvents(const QMatrixClient::Events& events);
+        void storeHistoricalEvents(const QMatrixClient::Events& events);
+        void storeGapEvents(const QMatrixClient::Events& events, int gapIndex,
+                            const QString& token);
+        void addHistoricalEvents(QMatrixClient::Events events);
+        void requestPreviousContent();
 };
 
 #endif // QUATERNIONROOM_H
@@ -0,0 +1,119 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "quickswitcher.h"
+
+#include <QtCore/QEvent>
+#include <QtGui/QKeyEvent>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QListWidget>
+#include <QtWidgets/QVBoxLayout>
+
+#include "quaternionroom.h"
+#include "roomsearchindex.h"
+
+static const int MaxResults = 20;
+
+QuickSwitcher::QuickSwitcher(QWidget* parent)
+    : QDialog(parent)
+    , index(nullptr)
+{
+    setWindowTitle(tr("Switch to Room"));
+    queryEdit = new QLineEdit();
+    queryEdit->setPlaceholderText(tr("Room name, alias or id"));
+    queryEdit->installEventFilter(this);
+    resultList = new QListWidget();
+
+    QVBoxLayout* mainLayout = new QVBoxLayout();
+    mainLayout->addWidget(queryEdit);
+    mainLayout->addWidget(resultList);
+    setLayout(mainLayout);
+
+    connect( queryEdit, &QLineEdit::textChanged, this, &QuickSwitcher::queryChanged );
+    connect( queryEdit, &QLineEdit::returnPressed, this, &QuickSwitcher::activateCurrent );
+    connect( resultList, &QListWidget::itemActivated, this, &QuickSwitcher::itemActivated );
+}
+
+void QuickSwitcher::setConnection(QMatrixClient::Connection* connection)
+{
+    delete index;
+    index = connection ? new RoomSearchIndex(connection, this) : nullptr;
+    resultList->clear();
+}
+
+void QuickSwitcher::popup()
+{
+    queryEdit->clear();
+    resultList->clear();
+    show();
+    raise();
+    activateWindow();
+    queryEdit->setFocus();
+}
+
+bool QuickSwitcher::eventFilter(QObject* watched, QEvent* event)
+{
+    // Let the arrow keys move through the results while typing
+    if (watched == queryEdit && event->type() == QEvent::KeyPress)
+    {
+        QKeyEvent* keyEvent = static_cast<QKeyEvent*>(event);
+        int row = resultList->currentRow();
+        if (keyEvent->key() == Qt::Key_Down && row + 1 < resultList->count())
+        {
+            resultList->setCurrentRow(row + 1);
+            return true;
+        }
+        if (keyEvent->key() == Qt::Key_Up && row > 0)
+        {
+            resultList->setCurrentRow(row - 1);
+            return true;
+        }
+    }
+    return QDialog::eventFilter(watched, event);
+}
+
+void QuickSwitcher::queryChanged(const QString& query)
+{
+    resultList->clear();
+    if (!index)
+        return;
+
+    for (const auto& match: index->find(query, MaxResults))
+    {
+        QListWidgetItem* item = new QListWidgetItem(match.room->displayName());
+        item->setToolTip(match.room->id());
+        item->setData(Qt::UserRole, QVariant::fromValue<QObject*>(match.room));
+        resultList->addItem(item);
+    }
+    if (resultList->count() > 0)
+        resultList->setCurrentRow(0);
+}
+
+void QuickSwitcher::itemActivated(QListWidgetItem* item)
+{
+    QObject* room = item->data(Qt::UserRole).value<QObject*>();
+    hide();
+    emit roomSelected(static_cast<QuaternionRoom*>(room));
+}
+
+void QuickSwitcher::activateCurrent()
+{
+    if (QListWidgetItem* item = resultList->currentItem())
+        itemActivated(item);
+}
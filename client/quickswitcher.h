@@ -0,0 +1,68 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef QUICKSWITCHER_H
+#define QUICKSWITCHER_H
+
+#include <QtWidgets/QDialog>
+
+namespace QMatrixClient
+{
+    class Connection;
+}
+
+class QLineEdit;
+class QListWidget;
+class QListWidgetItem;
+class QuaternionRoom;
+class RoomSearchIndex;
+
+/**
+ * A keyboard-driven popup to jump to a room by typing part of its name,
+ * alias or id.
+ */
+class QuickSwitcher : public QDialog
+{
+        Q_OBJECT
+    public:
+        QuickSwitcher(QWidget* parent = nullptr);
+
+        void setConnection(QMatrixClient::Connection* connection);
+
+        /** Clears the previous query and shows the switcher */
+        void popup();
+
+    signals:
+        void roomSelected(QuaternionRoom* room);
+
+    protected:
+        bool eventFilter(QObject* watched, QEvent* event) override;
+
+    private slots:
+        void queryChanged(const QString& query);
+        void itemActivated(QListWidgetItem* item);
+        void activateCurrent();
+
+    private:
+        QLineEdit* queryEdit;
+        QListWidget* resultList;
+        RoomSearchIndex* index;
+};
+
+#endif // QUICKSWITCHER_H
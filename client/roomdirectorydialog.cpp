@@ -0,0 +1,111 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "roomdirectorydialog.h"
+
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QListView>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QPushButton>
+#include <QtWidgets/QHBoxLayout>
+#include <QtWidgets/QVBoxLayout>
+
+#include "quaternionconnection.h"
+#include "models/publicroomsmodel.h"
+
+RoomDirectoryDialog::RoomDirectoryDialog(QuaternionConnection* connection, QWidget* parent)
+    : QDialog(parent)
+    , m_connection(connection)
+    , loading(false)
+{
+    setWindowTitle(tr("Room Directory"));
+    model = new PublicRoomsModel(connection, this);
+    searchEdit = new QLineEdit();
+    searchEdit->setPlaceholderText(tr("Search rooms"));
+    view = new QListView();
+    view->setModel(model);
+    view->setUniformItemSizes(true); // Rows don't need to be measured one by one
+    statusLabel = new QLabel();
+    joinButton = new QPushButton(tr("Join"));
+    joinButton->setEnabled(false);
+
+    QHBoxLayout* bottomLayout = new QHBoxLayout();
+    bottomLayout->addWidget(statusLabel, 1);
+    bottomLayout->addWidget(joinButton);
+
+    QVBoxLayout* mainLayout = new QVBoxLayout();
+    mainLayout->addWidget(searchEdit);
+    mainLayout->addWidget(view);
+    mainLayout->addLayout(bottomLayout);
+    setLayout(mainLayout);
+
+    // Don't send a search request on every keystroke
+    searchTimer.setSingleShot(true);
+    searchTimer.setInterval(300);
+    connect( &searchTimer, &QTimer::timeout, this, &RoomDirectoryDialog::search );
+    connect( searchEdit, &QLineEdit::textChanged, [=]{ searchTimer.start(); } );
+    connect( searchEdit, &QLineEdit::returnPressed, this, &RoomDirectoryDialog::search );
+
+    connect( model, &PublicRoomsModel::loadingChanged, [=](bool l) { loading = l; updateStatus(); } );
+    connect( model, &PublicRoomsModel::totalEstimateChanged, this, &RoomDirectoryDialog::updateStatus );
+    connect( model, &PublicRoomsModel::rowsInserted, this, &RoomDirectoryDialog::updateStatus );
+    connect( model, &PublicRoomsModel::modelReset, this, &RoomDirectoryDialog::updateStatus );
+    connect( model, &PublicRoomsModel::error, this, &RoomDirectoryDialog::error );
+    connect( view, &QListView::activated, this, &RoomDirectoryDialog::join );
+    connect( joinButton, &QPushButton::clicked, this, &RoomDirectoryDialog::join );
+    connect( view->selectionModel(), &QItemSelectionModel::currentChanged,
+             [=](const QModelIndex& current) { joinButton->setEnabled(current.isValid()); } );
+
+    resize(500, 600);
+    search();
+}
+
+void RoomDirectoryDialog::search()
+{
+    searchTimer.stop();
+    model->setSearchTerm(searchEdit->text());
+}
+
+void RoomDirectoryDialog::updateStatus()
+{
+    QString status = model->totalEstimate() >= 0
+        ? tr("%1 of about %2 rooms").arg(model->rowCount()).arg(model->totalEstimate())
+        : tr("%1 rooms").arg(model->rowCount());
+    if (loading)
+        status += tr(", loading...");
+    statusLabel->setText(status);
+}
+
+void RoomDirectoryDialog::error(const QString& message)
+{
+    statusLabel->setText(tr("Couldn't load the room directory: %1").arg(message));
+}
+
+void RoomDirectoryDialog::join()
+{
+    QModelIndex index = view->currentIndex();
+    if (!index.isValid())
+        return;
+    QString alias = index.data(PublicRoomsModel::AliasRole).toString();
+    QString roomId = index.data(PublicRoomsModel::RoomIdRole).toString();
+    if (alias.isEmpty() && roomId.isEmpty())
+        return; // Still loading
+    m_connection->joinRoom(alias.isEmpty() ? roomId : alias);
+    accept();
+}
@@ -0,0 +1,61 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef ROOMDIRECTORYDIALOG_H
+#define ROOMDIRECTORYDIALOG_H
+
+#include <QtWidgets/QDialog>
+#include <QtCore/QTimer>
+
+class QuaternionConnection;
+class PublicRoomsModel;
+class QLineEdit;
+class QListView;
+class QLabel;
+class QPushButton;
+class QModelIndex;
+
+/**
+ * Lets the user browse and search the public rooms of the homeserver
+ * and join one of them
+ */
+class RoomDirectoryDialog : public QDialog
+{
+        Q_OBJECT
+    public:
+        RoomDirectoryDialog(QuaternionConnection* connection, QWidget* parent = nullptr);
+
+    private slots:
+        void search();
+        void updateStatus();
+        void error(const QString& message);
+        void join();
+
+    private:
+        QuaternionConnection* m_connection;
+        PublicRoomsModel* model;
+        QLineEdit* searchEdit;
+        QListView* view;
+        QLabel* statusLabel;
+        QPushButton* joinButton;
+        QTimer searchTimer;
+        bool loading;
+};
+
+#endif // ROOMDIRECTORYDIALOG_H
@@ -22,6 +22,7 @@
 #include <QtCore/QSettings>
 #include <QtCore/QDebug>
 #include <QtWidgets/QMenu>
+#include <QtWidgets/QActionGroup>
 #include <QtWidgets/QStyledItemDelegate>
 
 #include "models/roomlistmodel.h"
@@ -48,10 +49,11 @@ void RoomListItemDelegate::paint(QPainter* painter, const QStyleOptionViewItem&
 {
     QStyleOptionViewItem o { option };
 
-    if (index.data(RoomListModel::HasUnreadRole).toBool())
+    const int flags = index.data(RoomListModel::RowFlagsRole).toInt();
+    if (flags & RoomListModel::UnreadFlag)
         o.font.setBold(true);
 
-    if (index.data(RoomListModel::HighlightCountRole).toInt() > 0)
+    if (flags & RoomListModel::HighlightedFlag)
     {
         // Highlighting the text may not work out on monochrome colour schemes,
         // hence duplicating with italic font.
@@ -82,6 +84,18 @@ RoomListDock::RoomListDock(QWidget* parent)
     leaveAction = new QAction(tr("Leave Room"), this);
     connect(leaveAction, &QAction::triggered, this, &RoomListDock::menuLeaveSelected);
     contextMenu->addAction(leaveAction);
+    contextMenu->addSeparator();
+    QActionGroup* orderGroup = new QActionGroup(this);
+    activityOrderAction = new QAction(tr("Sort by Activity"), orderGroup);
+    activityOrderAction->setCheckable(true);
+    unreadOrderAction = new QAction(tr("Sort Unread First"), orderGroup);
+    unreadOrderAction->setCheckable(true);
+    if( model->order() == RoomListModel::UnreadOrder )
+        unreadOrderAction->setChecked(true);
+    else
+        activityOrderAction->setChecked(true);
+    connect(orderGroup, &QActionGroup::triggered, this, &RoomListDock::orderSelected);
+    contextMenu->addActions(orderGroup->actions());
 
     setContextMenuPolicy(Qt::CustomContextMenu);
     connect(this, &QWidget::customContextMenuRequested, this, &RoomListDock::showContextMenu);
@@ -102,14 +116,23 @@ void RoomListDock::rowSelected(const QModelIndex& index)
     emit roomSelected( model->roomAt(index.row()) );
 }
 
+void RoomListDock::selectRoom(QuaternionRoom* room)
+{
+    const int row = model->rowOf(room);
+    if( row != -1 )
+        view->setCurrentIndex(model->index(row));
+    emit roomSelected(room);
+}
+
 void RoomListDock::showContextMenu(const QPoint& pos)
 {
     QModelIndex index = view->indexAt(view->mapFromParent(pos));
     if( !index.isValid() )
-        return;
-    QuaternionRoom* room = model->roomAt(index.row());
-
-    if( room->joinState() == QMatrixClient::JoinState::Join )
+    {
+        joinAction->setEnabled(false);
+        leaveAction->setEnabled(false);
+    }
+    else if( model->roomAt(index.row())->joinState() == QMatrixClient::JoinState::Join )
     {
         joinAction->setEnabled(false);
         leaveAction->setEnabled(true);
@@ -123,6 +146,12 @@ void RoomListDock::showContextMenu(const QPoint& pos)
     contextMenu->popup(mapToGlobal(pos));
 }
 
+void RoomListDock::orderSelected(QAction* action)
+{
+    model->setOrder(action == unreadOrderAction ? RoomListModel::UnreadOrder
+                                                : RoomListModel::ActivityOrder);
+}
+
 void RoomListDock::menuJoinSelected()
 {
     if (!connection)
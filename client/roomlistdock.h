@@ -38,6 +38,10 @@ class RoomListDock : public QDockWidget
 
         void setConnection( QMatrixClient::Connection* connection );
 
+    public slots:
+        /** Makes the room current in the list and opens it */
+        void selectRoom(QuaternionRoom* room);
+
     signals:
         void roomSelected(QuaternionRoom* room);
 
@@ -46,6 +50,7 @@ class RoomListDock : public QDockWidget
         void showContextMenu(const QPoint& pos);
         void menuJoinSelected();
         void menuLeaveSelected();
+        void orderSelected(QAction* action);
 
     private:
         QMatrixClient::Connection* connection;
@@ -54,6 +59,8 @@ class RoomListDock : public QDockWidget
         QMenu* contextMenu;
         QAction* joinAction;
         QAction* leaveAction;
+        QAction* activityOrderAction;
+        QAction* unreadOrderAction;
 };
 
 #endif // ROOMLISTDOCK_H
@@ -0,0 +1,144 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "roomsearchindex.h"
+
+#include "lib/connection.h"
+#include "lib/room.h"
+#include "quaternionroom.h"
+
+#include <algorithm>
+
+using namespace QMatrixClient;
+
+RoomSearchIndex::RoomSearchIndex(Connection* connection, QObject* parent)
+    : QObject(parent)
+{
+    m_candidates.reserve(connection->roomMap().size());
+    for (Room* r: connection->roomMap())
+        addRoom(r);
+    connect( connection, &Connection::newRoom, this, &RoomSearchIndex::addRoom );
+}
+
+QString RoomSearchIndex::normalize(const QString& text)
+{
+    // Decompose and drop the combining marks, so that "é" matches "e"
+    QString decomposed = text.normalized(QString::NormalizationForm_KD).toCaseFolded();
+    QString result;
+    result.reserve(decomposed.size());
+    for (QChar c: decomposed)
+        if (c.category() != QChar::Mark_NonSpacing)
+            result.append(c);
+    return result;
+}
+
+quint64 RoomSearchIndex::charMask(const QString& text)
+{
+    quint64 mask = 0;
+    for (QChar c: text)
+        mask |= quint64(1) << (c.unicode() % 64);
+    return mask;
+}
+
+int RoomSearchIndex::score(const QString& query, const QString& text)
+{
+    // Greedy subsequence match: consecutive characters and characters at
+    // word starts weigh more, skipped characters weigh less.
+    int result = 0;
+    int streak = 0;
+    int pos = 0;
+    for (QChar q: query)
+    {
+        int found = text.indexOf(q, pos);
+        if (found == -1)
+            return -1;
+        bool wordStart = found == 0 || !text.at(found - 1).isLetterOrNumber();
+        streak = pos > 0 && found == pos ? streak + 1 : 1;
+        result += 2 * streak + (wordStart ? 8 : 0) - qMin(found - pos, 8);
+        pos = found + 1;
+    }
+    if (query.size() == text.size())
+        result += 16; // Exact match
+    return result;
+}
+
+QVector<RoomSearchIndex::Match> RoomSearchIndex::find(const QString& query, int maxResults) const
+{
+    QVector<Match> result;
+    QString q = normalize(query);
+    q.remove(' ');
+    if (q.isEmpty())
+        return result;
+    const quint64 queryMask = charMask(q);
+
+    for (auto it = m_candidates.begin(); it != m_candidates.end(); ++it)
+    {
+        int best = -1;
+        for (const Candidate& c: it.value())
+        {
+            if ((queryMask & ~c.mask) != 0)
+                continue;
+            best = qMax(best, score(q, c.text));
+        }
+        if (best >= 0)
+        {
+            Match m { it.key(), best };
+            result.push_back(m);
+        }
+    }
+
+    auto better = [](const Match& a, const Match& b) {
+        if (a.score != b.score)
+            return a.score > b.score;
+        return a.room->lastActivity() > b.room->lastActivity();
+    };
+    if (result.size() > maxResults)
+    {
+        std::partial_sort(result.begin(), result.begin() + maxResults, result.end(), better);
+        result.resize(maxResults);
+    }
+    else
+        std::sort(result.begin(), result.end(), better);
+    return result;
+}
+
+void RoomSearchIndex::addRoom(Room* room)
+{
+    updateRoom(room);
+    connect( room, &Room::displaynameChanged, this, &RoomSearchIndex::updateRoom,
+             Qt::UniqueConnection );
+}
+
+void RoomSearchIndex::updateRoom(Room* room)
+{
+    QStringList texts;
+    texts << room->displayName() << room->canonicalAlias() << room->aliases()
+          << room->id();
+    texts.removeAll(QString());
+
+    QVector<Candidate> candidates;
+    candidates.reserve(texts.size());
+    for (const QString& t: texts)
+    {
+        Candidate c { normalize(t), 0 };
+        c.mask = charMask(c.text);
+        candidates.push_back(c);
+    }
+    m_candidates.insert(static_cast<QuaternionRoom*>(room), candidates);
+}
@@ -0,0 +1,83 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef ROOMSEARCHINDEX_H
+#define ROOMSEARCHINDEX_H
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtCore/QStringList>
+
+namespace QMatrixClient
+{
+    class Connection;
+    class Room;
+}
+
+class QuaternionRoom;
+
+/**
+ * Fuzzy search over the rooms of a connection.
+ *
+ * For every room, the display name, aliases and id are stored in a
+ * normalized form along with a bitmask of the characters they contain.
+ * A query first rejects candidates by the bitmask and only then scores
+ * the remaining ones as subsequence matches. The index follows
+ * Connection::newRoom and Room::displaynameChanged (which is also emitted
+ * when aliases change).
+ */
+class RoomSearchIndex: public QObject
+{
+        Q_OBJECT
+    public:
+        struct Match
+        {
+            QuaternionRoom* room;
+            int score;
+        };
+
+        explicit RoomSearchIndex(QMatrixClient::Connection* connection,
+                                 QObject* parent = nullptr);
+
+        /**
+         * Returns up to maxResults rooms matching the query, the best
+         * matches and, among equal ones, the most recently active first.
+         */
+        QVector<Match> find(const QString& query, int maxResults) const;
+
+    private slots:
+        void addRoom(QMatrixClient::Room* room);
+        void updateRoom(QMatrixClient::Room* room);
+
+    private:
+        struct Candidate
+        {
+            QString text;
+            quint64 mask;
+        };
+
+        QHash<QuaternionRoom*, QVector<Candidate>> m_candidates;
+
+        static QString normalize(const QString& text);
+        static quint64 charMask(const QString& text);
+        static int score(const QString& query, const QString& text);
+};
+
+#endif // ROOMSEARCHINDEX_H
@@ -0,0 +1,159 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "sortedmemberlist.h"
+
+#include <QtCore/QDebug>
+
+#include "lib/room.h"
+#include "lib/user.h"
+
+#include <algorithm>
+
+using namespace QMatrixClient;
+
+SortedMemberList::SortedMemberList(Room* room)
+    : QObject(room)
+    , m_room(room)
+{
+    m_collator.setCaseSensitivity(Qt::CaseInsensitive);
+    m_collator.setNumericMode(true);
+
+    const auto users = room->users();
+    m_entries.reserve(users.size());
+    m_keys.reserve(users.size());
+    for (User* u: users)
+    {
+        Entry e { keyFor(u), u };
+        m_entries.push_back(e);
+        m_keys.insert(u, e.key);
+    }
+    std::sort(m_entries.begin(), m_entries.end(),
+              [](const Entry& a, const Entry& b) { return less(a.key, b.key); });
+
+    connect( room, &Room::userAdded, this, &SortedMemberList::userAdded );
+    connect( room, &Room::userRemoved, this, &SortedMemberList::userRemoved );
+    connect( room, &Room::memberRenamed, this, &SortedMemberList::memberRenamed );
+}
+
+int SortedMemberList::count() const
+{
+    return int(m_entries.size());
+}
+
+User* SortedMemberList::at(int pos) const
+{
+    return m_entries.at(pos).user;
+}
+
+int SortedMemberList::indexOf(User* user) const
+{
+    auto it = m_keys.find(user);
+    if (it == m_keys.end())
+        return -1;
+    int pos = lowerBound(*it);
+    return pos < count() && m_entries.at(pos).user == user ? pos : -1;
+}
+
+SortedMemberList::Key SortedMemberList::keyFor(User* user) const
+{
+    QString name = m_room->roomMembername(user);
+    if (name.startsWith('@'))
+        name.remove(0, 1);
+    Key key { m_collator.sortKey(name), user->id() };
+    return key;
+}
+
+bool SortedMemberList::less(const Key& a, const Key& b)
+{
+    const int c = a.name.compare(b.name);
+    return c != 0 ? c < 0 : a.userId < b.userId;
+}
+
+int SortedMemberList::lowerBound(const Key& key) const
+{
+    return int(std::lower_bound(m_entries.begin(), m_entries.end(), key,
+                    [](const Entry& e, const Key& k) { return less(e.key, k); })
+               - m_entries.begin());
+}
+
+void SortedMemberList::insert(User* user)
+{
+    Key key = keyFor(user);
+    int pos = lowerBound(key);
+    Entry e { key, user };
+    emit aboutToInsert(pos);
+    m_entries.insert(m_entries.begin() + pos, e);
+    m_keys.insert(user, key);
+    emit inserted();
+}
+
+void SortedMemberList::remove(User* user)
+{
+    int pos = indexOf(user);
+    if (pos == -1)
+    {
+        qWarning() << "Trying to remove a room member not in the member list";
+        return;
+    }
+    emit aboutToRemove(pos);
+    m_entries.erase(m_entries.begin() + pos);
+    m_keys.remove(user);
+    emit removed();
+}
+
+void SortedMemberList::userAdded(User* user)
+{
+    if (!m_keys.contains(user))
+        insert(user);
+}
+
+void SortedMemberList::userRemoved(User* user)
+{
+    remove(user);
+}
+
+void SortedMemberList::memberRenamed(User* user)
+{
+    // The stored key still has the old name, so the entry can be found
+    int from = indexOf(user);
+    if (from == -1)
+    {
+        qWarning() << "Trying to rename a room member not in the member list";
+        return;
+    }
+    Key key = keyFor(user);
+    m_keys.insert(user, key);
+    // The new position, counted as if the member were already taken out
+    int to = lowerBound(key);
+    if (to > from)
+        --to;
+    if (to == from)
+    {
+        m_entries[from].key = key;
+        emit changed(from);
+        return;
+    }
+
+    emit aboutToMove(from, to);
+    Entry e { key, user };
+    m_entries.erase(m_entries.begin() + from);
+    m_entries.insert(m_entries.begin() + to, e);
+    emit moved();
+}
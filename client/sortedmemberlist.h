@@ -0,0 +1,97 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef SORTEDMEMBERLIST_H
+#define SORTEDMEMBERLIST_H
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QCollator>
+
+#include <vector>
+
+namespace QMatrixClient
+{
+    class Room;
+    class User;
+}
+
+/**
+ * Room members sorted by their display names.
+ *
+ * Each member is stored along with a precomputed sort key: the collation
+ * key of the display name without a leading '@' (from a QCollator for the
+ * current locale, case insensitive and with numbers in numeric order),
+ * and the user id to tell apart members with the same name. Sorting and
+ * lookups only compare these keys and never call back into the room. The list is
+ * updated incrementally as members join, leave or get renamed.
+ */
+class SortedMemberList: public QObject
+{
+        Q_OBJECT
+    public:
+        explicit SortedMemberList(QMatrixClient::Room* room);
+
+        int count() const;
+        QMatrixClient::User* at(int pos) const;
+        /** Returns the position of the user or -1 if it's not a member */
+        int indexOf(QMatrixClient::User* user) const;
+
+    signals:
+        void aboutToInsert(int pos);
+        void inserted();
+        void aboutToRemove(int pos);
+        void removed();
+        /** A member moved from one position to another after a rename */
+        void aboutToMove(int from, int to);
+        void moved();
+        /** A member got renamed without changing its position */
+        void changed(int pos);
+
+    private slots:
+        void userAdded(QMatrixClient::User* user);
+        void userRemoved(QMatrixClient::User* user);
+        void memberRenamed(QMatrixClient::User* user);
+
+    private:
+        struct Key
+        {
+            QCollatorSortKey name;
+            QString userId;
+        };
+        struct Entry
+        {
+            Key key;
+            QMatrixClient::User* user;
+        };
+
+        QMatrixClient::Room* m_room;
+        QCollator m_collator;
+        // QVector would need QCollatorSortKey to be default-constructible
+        std::vector<Entry> m_entries;
+        QHash<QMatrixClient::User*, Key> m_keys;
+
+        Key keyFor(QMatrixClient::User* user) const;
+        static bool less(const Key& a, const Key& b);
+        int lowerBound(const Key& key) const;
+        void insert(QMatrixClient::User* user);
+        void remove(QMatrixClient::User* user);
+};
+
+#endif // SORTEDMEMBERLIST_H
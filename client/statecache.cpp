@@ -0,0 +1,270 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "statecache.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QUrl>
+
+// Bump this when the cached data changes its meaning
+static const int CacheVersion = 3;
+
+StateCache::StateCache(const QString& userId)
+    : m_userId(userId), m_dirty(false)
+{
+    QString dir =
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/state";
+    m_fileName = QDir(dir).filePath(
+        QString::fromLatin1(QUrl::toPercentEncoding(userId)) + ".cache");
+    m_maxTimelineEvents =
+        qMax(1, QSettings().value("Cache/timeline_events", 30).toInt());
+}
+
+bool StateCache::isDirty() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_dirty;
+}
+
+void StateCache::update(const QJsonObject& syncResponse)
+{
+    QMutexLocker locker(&m_mutex);
+    merge(syncResponse);
+}
+
+void StateCache::merge(const QJsonObject& syncResponse)
+{
+    const QString nextBatch = syncResponse.value("next_batch").toString();
+    if (!nextBatch.isEmpty())
+        m_nextBatch = nextBatch;
+
+    const QJsonObject rooms = syncResponse.value("rooms").toObject();
+    const QJsonObject joined = rooms.value("join").toObject();
+    for (auto it = joined.begin(); it != joined.end(); ++it)
+    {
+        m_invitedRooms.remove(it.key());
+        updateJoinedRoom(m_joinedRooms[it.key()], it.value().toObject());
+    }
+    const QJsonObject invited = rooms.value("invite").toObject();
+    for (auto it = invited.begin(); it != invited.end(); ++it)
+        m_invitedRooms.insert(it.key(), it.value().toObject());
+    // Left rooms will come with the next initial sync if ever needed
+    const QJsonObject left = rooms.value("leave").toObject();
+    for (auto it = left.begin(); it != left.end(); ++it)
+    {
+        m_joinedRooms.remove(it.key());
+        m_invitedRooms.remove(it.key());
+    }
+    m_dirty = true;
+}
+
+void StateCache::updateJoinedRoom(StateCache::Room& room, const QJsonObject& json)
+{
+    auto addState = [&room](const QJsonArray& events) {
+        for (const QJsonValue& v: events)
+        {
+            const QJsonObject event = v.toObject();
+            if (!event.contains("state_key"))
+                continue;
+            room.state.insert(event.value("type").toString() + '\n' +
+                              event.value("state_key").toString(), event);
+        }
+    };
+    addState(json.value("state").toObject().value("events").toArray());
+
+    const QJsonObject timeline = json.value("timeline").toObject();
+    const QJsonArray events = timeline.value("events").toArray();
+    addState(events);
+    if (timeline.value("limited").toBool())
+    {
+        // There's a gap before this batch, older batches don't connect to it
+        room.timeline.clear();
+        room.timelineSize = 0;
+    }
+    if (!events.isEmpty())
+    {
+        TimelineBatch batch { timeline.value("prev_batch").toString(), events };
+        room.timeline.push_back(batch);
+        room.timelineSize += events.size();
+    }
+    // Only whole batches are dropped, so that the pagination token of the
+    // oldest one still points right before its first event
+    while (room.timeline.size() > 1 &&
+           room.timelineSize - room.timeline.front().events.size() >= m_maxTimelineEvents)
+    {
+        room.timelineSize -= room.timeline.front().events.size();
+        room.timeline.pop_front();
+    }
+
+    if (json.contains("unread_notifications"))
+        room.unreadNotifications = json.value("unread_notifications").toObject();
+
+    // Without the user's own receipt every restored room would look unread
+    for (const QJsonValue& v: json.value("ephemeral").toObject().value("events").toArray())
+    {
+        const QJsonObject event = v.toObject();
+        if (event.value("type").toString() != "m.receipt")
+            continue;
+        const QJsonObject content = event.value("content").toObject();
+        for (auto it = content.begin(); it != content.end(); ++it)
+        {
+            const QJsonObject read = it.value().toObject().value("m.read").toObject();
+            if (read.contains(m_userId))
+            {
+                room.readEventId = it.key();
+                room.readReceipt = read.value(m_userId).toObject();
+            }
+        }
+    }
+    for (const QJsonValue& v: json.value("account_data").toObject().value("events").toArray())
+    {
+        const QJsonObject event = v.toObject();
+        if (event.value("type").toString() == "m.fully_read")
+            room.fullyRead = event;
+    }
+}
+
+QJsonObject StateCache::toSyncResponse() const
+{
+    QJsonObject joined;
+    for (auto it = m_joinedRooms.begin(); it != m_joinedRooms.end(); ++it)
+    {
+        const Room& room = it.value();
+        QJsonArray stateEvents;
+        for (const QJsonObject& e: room.state)
+            stateEvents.append(e);
+        QJsonObject state;
+        state.insert("events", stateEvents);
+
+        QJsonArray timelineEvents;
+        for (const TimelineBatch& batch: room.timeline)
+            for (const QJsonValue& e: batch.events)
+                timelineEvents.append(e);
+        QJsonObject timeline;
+        timeline.insert("events", timelineEvents);
+        timeline.insert("limited", true);
+        if (!room.timeline.isEmpty())
+            timeline.insert("prev_batch", room.timeline.front().prevBatch);
+
+        QJsonObject roomJson;
+        roomJson.insert("state", state);
+        roomJson.insert("timeline", timeline);
+        roomJson.insert("unread_notifications", room.unreadNotifications);
+        if (!room.readEventId.isEmpty())
+        {
+            QJsonObject read;
+            read.insert(m_userId, room.readReceipt);
+            QJsonObject receipt;
+            receipt.insert("m.read", read);
+            QJsonObject content;
+            content.insert(room.readEventId, receipt);
+            QJsonObject event;
+            event.insert("type", QString("m.receipt"));
+            event.insert("content", content);
+            QJsonArray events;
+            events.append(event);
+            QJsonObject ephemeral;
+            ephemeral.insert("events", events);
+            roomJson.insert("ephemeral", ephemeral);
+        }
+        if (!room.fullyRead.isEmpty())
+        {
+            QJsonArray events;
+            events.append(room.fullyRead);
+            QJsonObject accountData;
+            accountData.insert("events", events);
+            roomJson.insert("account_data", accountData);
+        }
+        joined.insert(it.key(), roomJson);
+    }
+    QJsonObject invited;
+    for (auto it = m_invitedRooms.begin(); it != m_invitedRooms.end(); ++it)
+        invited.insert(it.key(), it.value());
+
+    QJsonObject rooms;
+    rooms.insert("join", joined);
+    rooms.insert("invite", invited);
+    QJsonObject response;
+    response.insert("next_batch", m_nextBatch);
+    response.insert("rooms", rooms);
+    response.insert("cache_version", CacheVersion);
+    return response;
+}
+
+bool StateCache::save()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_nextBatch.isEmpty())
+        return false;
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Couldn't open the state cache for writing:" << file.errorString();
+        return false;
+    }
+    // Binary JSON is deprecated since Qt 5.15; compact text parses nearly as fast
+    file.write(QJsonDocument(toSyncResponse()).toJson(QJsonDocument::Compact));
+    if (!file.commit())
+    {
+        qWarning() << "Couldn't write the state cache:" << file.errorString();
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
+
+QJsonObject StateCache::load()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QJsonObject();
+
+    const QJsonObject response = QJsonDocument::fromJson(file.readAll()).object();
+    if (response.value("cache_version").toInt() != CacheVersion ||
+            response.value("next_batch").toString().isEmpty())
+    {
+        qWarning() << "Ignoring an unusable state cache in" << m_fileName;
+        return QJsonObject();
+    }
+    QMutexLocker locker(&m_mutex);
+    m_joinedRooms.clear();
+    m_invitedRooms.clear();
+    merge(response);
+    m_dirty = false;
+    return response;
+}
+
+void StateCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_nextBatch.clear();
+    m_joinedRooms.clear();
+    m_invitedRooms.clear();
+    m_dirty = false;
+    QFile::remove(m_fileName);
+}
@@ -0,0 +1,96 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef STATECACHE_H
+#define STATECACHE_H
+
+#include <QtCore/QHash>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonObject>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+/**
+ * A local copy of the account state, to start from on the next launch
+ * instead of doing a full initial sync.
+ *
+ * The cache is fed with the raw /sync responses and keeps, for every
+ * room, the current state events, the recent timeline batches, the
+ * unread counters and the user's own read markers. load() returns all
+ * of it in the shape of a sync response, so restoring goes through the
+ * same code as syncing.
+ *
+ * update() is called from the sync worker thread while saving happens
+ * on the GUI thread, so all public methods are thread-safe.
+ */
+class StateCache
+{
+    public:
+        explicit StateCache(const QString& userId);
+
+        /** Merges a /sync response into the cache */
+        void update(const QJsonObject& syncResponse);
+        bool isDirty() const;
+
+        /** Writes the cache to disk; returns false on failure */
+        bool save();
+        /**
+         * Reads the cache from disk and returns it as a sync response, or
+         * an empty object if there's no usable cache
+         */
+        QJsonObject load();
+        /** Forgets everything, including the file on disk */
+        void clear();
+
+    private:
+        struct TimelineBatch
+        {
+            QString prevBatch;
+            QJsonArray events;
+        };
+
+        struct Room
+        {
+            QHash<QString, QJsonObject> state; // By type and state key
+            QList<TimelineBatch> timeline;
+            int timelineSize;
+            QJsonObject unreadNotifications;
+            QString readEventId; // The user's own m.read receipt
+            QJsonObject readReceipt;
+            QJsonObject fullyRead; // m.fully_read account data event
+
+            Room() : timelineSize(0) { }
+        };
+
+        QString m_userId;
+        QString m_fileName;
+        QString m_nextBatch;
+        QHash<QString, Room> m_joinedRooms;
+        QHash<QString, QJsonObject> m_invitedRooms;
+        int m_maxTimelineEvents;
+        bool m_dirty;
+        mutable QMutex m_mutex;
+
+        void merge(const QJsonObject& syncResponse);
+        void updateJoinedRoom(Room& room, const QJsonObject& json);
+        QJsonObject toSyncResponse() const;
+};
+
+#endif // STATECACHE_H
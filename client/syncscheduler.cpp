@@ -0,0 +1,145 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "syncscheduler.h"
+#include "quaternionconnection.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QSettings>
+
+static const int MinRetryDelay = 1000;
+
+SyncScheduler::SyncScheduler(QuaternionConnection* connection, QObject* parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_failures(0)
+    , m_catchUp(false)
+    , m_running(false)
+    , m_connected(false)
+{
+    QSettings settings;
+    m_timeout = qMax(0, settings.value("Sync/timeout", 30).toInt()) * 1000;
+    m_maxRetryDelay = qMax(1, settings.value("Sync/max_retry_delay", 300).toInt()) * 1000;
+    m_catchUpAfter = qMax(0, settings.value("Sync/catchup_after", 600).toInt()) * 1000;
+    // qrand() is seeded per thread; without this all clients would retry in step
+    qsrand(uint(QDateTime::currentMSecsSinceEpoch()) ^ uint(quintptr(this)));
+
+    m_retryTimer.setSingleShot(true);
+    connect( &m_retryTimer, &QTimer::timeout, this, &SyncScheduler::syncNow );
+    connect( connection, &QuaternionConnection::syncDone, this, &SyncScheduler::syncDone );
+    connect( connection, &QuaternionConnection::syncFailed, this, &SyncScheduler::syncFailed );
+}
+
+void SyncScheduler::start(bool catchUp)
+{
+    m_running = true;
+    m_connected = false;
+    m_failures = 0;
+    m_catchUp = catchUp;
+    syncNow();
+}
+
+void SyncScheduler::stop()
+{
+    m_running = false;
+    m_retryTimer.stop();
+}
+
+SyncScheduler::ErrorKind SyncScheduler::classify(int httpStatus, const QString& errcode)
+{
+    if (httpStatus == 0)
+        return NetworkError;
+    if (httpStatus == 429 || errcode == "M_LIMIT_EXCEEDED")
+        return RateLimited;
+    if (httpStatus == 401 || errcode == "M_UNKNOWN_TOKEN" || errcode == "M_MISSING_TOKEN")
+        return AuthError;
+    // Other errors are retried like server ones; they may be transient
+    // problems of a proxy in front of the server
+    return ServerError;
+}
+
+void SyncScheduler::syncNow()
+{
+    if (!m_running)
+        return;
+    if (m_catchUp)
+        qDebug() << "Catching up with a larger sync batch";
+    // A catch-up sync returns whatever there is, without waiting
+    m_connection->sync(m_catchUp ? 0 : m_timeout, m_catchUp);
+}
+
+void SyncScheduler::syncDone()
+{
+    if (m_failures > 0)
+    {
+        qDebug() << "Sync is back after" << m_failures << "failed attempt(s)";
+        emit showStatusMessage(tr("Reconnected"), 5000);
+    }
+    if (!m_connected)
+    {
+        m_connected = true;
+        emit connected();
+    }
+    m_failures = 0;
+    m_catchUp = false;
+    m_sinceLastSync.start();
+    syncNow();
+}
+
+void SyncScheduler::syncFailed(int httpStatus, const QString& errcode,
+                               int retryAfterMs, const QString& message)
+{
+    if (!m_running)
+        return;
+
+    const ErrorKind kind = classify(httpStatus, errcode);
+    if (kind == AuthError)
+    {
+        qWarning() << "Sync failed, the access token is not accepted:" << message;
+        stop();
+        emit authFailed(message);
+        return;
+    }
+
+    ++m_failures;
+    int delay = retryDelay();
+    if (kind == RateLimited && retryAfterMs > delay)
+        delay = retryAfterMs;
+    if (m_sinceLastSync.isValid() && m_sinceLastSync.elapsed() > m_catchUpAfter)
+        m_catchUp = true;
+
+    const char* kindName[] = { "network error", "server error", "rate limited" };
+    qWarning() << "Sync failed (" << kindName[kind] << httpStatus << errcode << "):"
+               << message << "- attempt" << m_failures << "retrying in" << delay << "ms";
+    emit showStatusMessage(kind == NetworkError
+        ? tr("Couldn't reach the server, retrying in %1 s").arg((delay + 999) / 1000)
+        : tr("Server problem (%1), retrying in %2 s").arg(message).arg((delay + 999) / 1000),
+        delay);
+    m_retryTimer.start(delay);
+}
+
+int SyncScheduler::retryDelay() const
+{
+    // Doubles with every failure; the random part spreads out clients
+    // that lost the connection at the same time
+    const int shift = qMin(m_failures - 1, 20);
+    const int base = int(qMin(qint64(m_maxRetryDelay), qint64(MinRetryDelay) << shift));
+    return base / 2 + qrand() % (base / 2 + 1);
+}
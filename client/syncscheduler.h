@@ -0,0 +1,85 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef SYNCSCHEDULER_H
+#define SYNCSCHEDULER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
+
+class QuaternionConnection;
+
+/**
+ * Drives the sync loop of a connection.
+ *
+ * Long-polls use a timeout of "Sync/timeout" seconds (30 by default).
+ * Failed syncs are retried with an exponential, jittered delay of up to
+ * "Sync/max_retry_delay" seconds (300 by default), so a degraded server
+ * isn't hammered by every client at once; rate limiting responses are
+ * honoured, and an invalid access token ends the session instead.
+ * After being offline for more than "Sync/catchup_after" seconds (600 by
+ * default) the next sync is a catch-up one with larger batches.
+ */
+class SyncScheduler: public QObject
+{
+        Q_OBJECT
+    public:
+        enum ErrorKind { NetworkError, ServerError, RateLimited, AuthError };
+
+        SyncScheduler(QuaternionConnection* connection, QObject* parent = nullptr);
+
+        /**
+         * Starts syncing; catchUp makes the first sync a catch-up one,
+         * e.g. when starting from a cached state of unknown age
+         */
+        void start(bool catchUp);
+        void stop();
+
+        static ErrorKind classify(int httpStatus, const QString& errcode);
+
+    signals:
+        void showStatusMessage(const QString& message, int timeout);
+        /** The first successful sync after start() or after failures */
+        void connected();
+        /** The server doesn't accept the access token anymore */
+        void authFailed(const QString& message);
+
+    private slots:
+        void syncNow();
+        void syncDone();
+        void syncFailed(int httpStatus, const QString& errcode,
+                        int retryAfterMs, const QString& message);
+
+    private:
+        QuaternionConnection* m_connection;
+        QTimer m_retryTimer;
+        QElapsedTimer m_sinceLastSync;
+        int m_timeout;
+        int m_maxRetryDelay;
+        int m_catchUpAfter;
+        int m_failures;
+        bool m_catchUp;
+        bool m_running;
+        bool m_connected;
+
+        int retryDelay() const;
+};
+
+#endif // SYNCSCHEDULER_H
@@ -0,0 +1,321 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "timelinestore.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+#include <QtCore/QtEndian>
+
+const qint64 TimelineStore::NoPosition;
+
+// Positions within a segment start in the middle of its range, so that
+// the segment can grow in both directions
+static const qint64 SegmentMiddle = Q_INT64_C(0x80000000);
+
+TimelineStore::TimelineStore(const QString& userId, const QString& roomId)
+    : m_loaded(false)
+    , m_failed(false)
+    , m_filesOpen(false)
+    , m_map(nullptr)
+    , m_mapSize(0)
+    , m_logEnd(0)
+    , m_lastSegment(0)
+{
+    // Per user: what one account may see in a room is not what another may
+    m_dir = userDir(userId) + '/' + QString::fromLatin1(QUrl::toPercentEncoding(roomId));
+}
+
+TimelineStore::~TimelineStore()
+{
+    close();
+}
+
+QString TimelineStore::userDir(const QString& userId)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + "/timeline/" + QString::fromLatin1(QUrl::toPercentEncoding(userId));
+}
+
+void TimelineStore::removeAll(const QString& userId)
+{
+    if (!userId.isEmpty())
+        QDir(userDir(userId)).removeRecursively();
+}
+
+void TimelineStore::flush()
+{
+    if (!m_filesOpen)
+        return;
+    // The log goes first: index entries past the end of the log are
+    // dropped on loading, the other way round they'd point to nothing
+    if (!m_log.flush() || !m_indexFile.flush() || !m_segmentsFile.flush())
+    {
+        qWarning() << "Couldn't write to the timeline store in" << m_dir;
+        m_failed = true;
+    }
+}
+
+void TimelineStore::close()
+{
+    flush();
+    if (m_map)
+        m_logReader.unmap(m_map);
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_log.close();
+    m_logReader.close();
+    m_indexFile.close();
+    m_segmentsFile.close();
+    m_filesOpen = false;
+}
+
+quint32 TimelineStore::idHash(const QString& eventId)
+{
+    // FNV-1a; qHash() is seeded per process and can't be stored
+    quint32 hash = 2166136261u;
+    for (char c: eventId.toUtf8())
+    {
+        hash ^= quint8(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+quint32 TimelineStore::segmentOf(qint64 position)
+{
+    return quint32(position >> 32);
+}
+
+bool TimelineStore::ensureLoaded()
+{
+    if (m_loaded)
+        return !m_failed;
+    m_loaded = true;
+
+    QDir dir(m_dir);
+    m_log.setFileName(dir.filePath("events.log"));
+    m_logReader.setFileName(m_log.fileName());
+    m_indexFile.setFileName(dir.filePath("events.idx"));
+    m_segmentsFile.setFileName(dir.filePath("segments"));
+    if (!dir.mkpath("."))
+    {
+        qWarning() << "Couldn't create the timeline store in" << m_dir;
+        m_failed = true;
+        return false;
+    }
+
+    // Entries written after the last complete event in the log (e.g. when
+    // the client crashed in the middle of an append) are ignored
+    QFile indexFile(m_indexFile.fileName());
+    const QByteArray indexData =
+        indexFile.open(QIODevice::ReadOnly) ? indexFile.readAll() : QByteArray();
+    indexFile.close();
+    const int count = indexData.size() / int(sizeof(IndexEntry));
+    const qint64 logSize = QFileInfo(m_log.fileName()).size();
+    m_index.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        IndexEntry entry;
+        memcpy(&entry, indexData.constData() + i * sizeof(IndexEntry), sizeof(IndexEntry));
+        if (entry.offset + entry.length > logSize)
+            break;
+        m_byPosition.insert(entry.position, m_index.size());
+        m_byIdHash.insert(entry.idHash, m_index.size());
+        m_lastSegment = qMax(m_lastSegment, segmentOf(entry.position));
+        m_index.push_back(entry);
+    }
+    if (indexData.size() != int(m_index.size() * sizeof(IndexEntry)))
+        QFile::resize(m_indexFile.fileName(), m_index.size() * sizeof(IndexEntry));
+
+    QFile segmentsFile(m_segmentsFile.fileName());
+    if (segmentsFile.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream segments(&segmentsFile);
+        while (!segments.atEnd())
+        {
+            const QStringList parts = segments.readLine().split(' ');
+            if (parts.size() != 2)
+                continue;
+            const quint32 segment = parts.at(0).toUInt();
+            m_segmentTokens.insert(segment, parts.at(1));
+            m_lastSegment = qMax(m_lastSegment, segment);
+        }
+    }
+    return true;
+}
+
+bool TimelineStore::openFiles()
+{
+    if (!ensureLoaded())
+        return false;
+    if (m_filesOpen)
+        return true;
+
+    if (!m_log.open(QIODevice::WriteOnly | QIODevice::Append) ||
+        !m_logReader.open(QIODevice::ReadOnly) ||
+        !m_indexFile.open(QIODevice::WriteOnly | QIODevice::Append) ||
+        !m_segmentsFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+    {
+        qWarning() << "Couldn't open the timeline store in" << m_dir;
+        close();
+        return false;
+    }
+    m_logEnd = m_log.size();
+    m_filesOpen = true;
+    return true;
+}
+
+QByteArray TimelineStore::read(const IndexEntry& entry)
+{
+    if (entry.offset + entry.length > m_mapSize)
+    {
+        // The log has grown since it was mapped; the event may still be
+        // in the write buffer
+        flush();
+        if (m_map)
+            m_logReader.unmap(m_map);
+        m_mapSize = m_logReader.size();
+        m_map = m_logReader.map(0, m_mapSize);
+        if (!m_map)
+        {
+            m_mapSize = 0;
+            m_logReader.seek(entry.offset);
+            return m_logReader.read(entry.length);
+        }
+    }
+    return QByteArray(reinterpret_cast<const char*>(m_map + entry.offset), entry.length);
+}
+
+qint64 TimelineStore::find(const QString& eventId)
+{
+    if (!ensureLoaded())
+        return NoPosition;
+
+    const QList<int> candidates = m_byIdHash.values(idHash(eventId));
+    if (candidates.isEmpty() || !openFiles())
+        return NoPosition;
+    for (int i: candidates)
+    {
+        const IndexEntry& entry = m_index.at(i);
+        if (QJsonDocument::fromJson(read(entry)).object()
+                .value("event_id").toString() == eventId)
+            return entry.position;
+    }
+    return NoPosition;
+}
+
+qint64 TimelineStore::store(qint64 position, const QString& eventId, const QByteArray& json)
+{
+    if (!openFiles())
+        return NoPosition;
+
+    // The length prefix lets the log be read without the index
+    uchar length[4];
+    qToLittleEndian<quint32>(json.size(), length);
+    // QFile::size() would flush the buffer, so the end is tracked here
+    const qint64 offset = m_logEnd;
+    if (m_log.write(reinterpret_cast<const char*>(length), 4) != 4 ||
+            m_log.write(json) != json.size())
+    {
+        qWarning() << "Couldn't write to the timeline store:" << m_log.errorString();
+        // Part of the event may be in the log already
+        m_failed = true;
+        return NoPosition;
+    }
+    m_logEnd += 4 + json.size();
+
+    IndexEntry entry { position, offset + 4, quint32(json.size()), idHash(eventId) };
+    m_indexFile.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    m_byPosition.insert(position, m_index.size());
+    m_byIdHash.insert(entry.idHash, m_index.size());
+    m_index.push_back(entry);
+    return position;
+}
+
+qint64 TimelineStore::appendAfter(qint64 position, const QString& eventId, const QByteArray& json)
+{
+    if (!ensureLoaded() || m_byPosition.contains(position + 1) ||
+            segmentOf(position + 1) != segmentOf(position))
+        return NoPosition;
+    return store(position + 1, eventId, json);
+}
+
+qint64 TimelineStore::prependBefore(qint64 position, const QString& eventId, const QByteArray& json)
+{
+    if (!ensureLoaded() || m_byPosition.contains(position - 1) ||
+            segmentOf(position - 1) != segmentOf(position))
+        return NoPosition;
+    return store(position - 1, eventId, json);
+}
+
+qint64 TimelineStore::startSegment(const QString& eventId, const QByteArray& json,
+                                   const QString& prevToken)
+{
+    if (!ensureLoaded())
+        return NoPosition;
+    const qint64 position = (qint64(++m_lastSegment) << 32) + SegmentMiddle;
+    if (store(position, eventId, json) == NoPosition)
+        return NoPosition;
+    if (!prevToken.isEmpty())
+        setSegmentToken(position, prevToken);
+    return position;
+}
+
+QJsonArray TimelineStore::readBefore(qint64 position, int limit)
+{
+    QJsonArray result;
+    if (!ensureLoaded() || !m_byPosition.contains(position - 1) || !openFiles())
+        return result;
+
+    for (qint64 p = position - 1; result.size() < limit; --p)
+    {
+        auto it = m_byPosition.find(p);
+        if (it == m_byPosition.end() || segmentOf(p) != segmentOf(position))
+            break;
+        result.append(QJsonDocument::fromJson(read(m_index.at(*it))).object());
+    }
+    return result;
+}
+
+QString TimelineStore::segmentToken(qint64 position)
+{
+    if (!ensureLoaded())
+        return QString();
+    return m_segmentTokens.value(segmentOf(position));
+}
+
+void TimelineStore::setSegmentToken(qint64 position, const QString& token)
+{
+    if (!ensureLoaded() || token.isEmpty())
+        return;
+    const quint32 segment = segmentOf(position);
+    if (m_segmentTokens.value(segment) == token || !openFiles())
+        return;
+    // Appended as well; the last line for a segment wins
+    m_segmentsFile.write(QString("%1 %2\n").arg(segment).arg(token).toUtf8());
+    m_segmentTokens.insert(segment, token);
+}
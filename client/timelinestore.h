@@ -0,0 +1,121 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef TIMELINESTORE_H
+#define TIMELINESTORE_H
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QJsonArray>
+#include <QtCore/QVector>
+
+/**
+ * An on-disk log of the timeline events of one room.
+ *
+ * Events are appended to a log file and never rewritten; a separate index
+ * file keeps a fixed-size entry per event with its timeline position and
+ * its place in the log. The log is memory-mapped for reading.
+ *
+ * Positions are ordered like the timeline. Events known to follow each
+ * other directly have consecutive positions within one segment; when the
+ * continuity is unknown (after a gap in the sync), a new segment starts.
+ * Each segment may remember a pagination token pointing right before its
+ * earliest event, so that the server can continue where the store ends.
+ *
+ * The index is read on first use and kept in memory. The files themselves
+ * are opened on demand and stay open only until close(), which callers
+ * do after each batch of operations, so that rooms don't hold file
+ * descriptors while idle. Writes are buffered and flushed to disk in
+ * close(), once per batch.
+ *
+ * Stores are kept per user and removed with removeAll() on logout.
+ */
+class TimelineStore
+{
+    public:
+        static const qint64 NoPosition = -1;
+
+        TimelineStore(const QString& userId, const QString& roomId);
+        ~TimelineStore();
+
+        /** Flushes and closes the files; they are reopened when needed */
+        void close();
+        /** Deletes the stores of all rooms of the user */
+        static void removeAll(const QString& userId);
+
+        /** Returns the position of the event or NoPosition */
+        qint64 find(const QString& eventId);
+
+        /**
+         * Stores an event right after (or before) the one at the given
+         * position and returns its position, or NoPosition if that place
+         * is already taken.
+         */
+        qint64 appendAfter(qint64 position, const QString& eventId, const QByteArray& json);
+        qint64 prependBefore(qint64 position, const QString& eventId, const QByteArray& json);
+        /** Stores an event in a new segment and returns its position */
+        qint64 startSegment(const QString& eventId, const QByteArray& json,
+                            const QString& prevToken = QString());
+
+        /**
+         * Returns up to limit events directly preceding the position, the
+         * newest first, in the format of a /messages chunk
+         */
+        QJsonArray readBefore(qint64 position, int limit);
+
+        QString segmentToken(qint64 position);
+        void setSegmentToken(qint64 position, const QString& token);
+
+    private:
+        struct IndexEntry
+        {
+            qint64 position;
+            qint64 offset;
+            quint32 length;
+            quint32 idHash;
+        };
+
+        QString m_dir;
+        bool m_loaded;
+        bool m_failed;
+        bool m_filesOpen;
+        QFile m_log;
+        QFile m_logReader;
+        QFile m_indexFile;
+        QFile m_segmentsFile;
+        uchar* m_map;
+        qint64 m_mapSize;
+        qint64 m_logEnd; // Including the writes not flushed yet
+        QVector<IndexEntry> m_index;
+        QHash<qint64, int> m_byPosition;
+        QMultiHash<quint32, int> m_byIdHash;
+        QHash<quint32, QString> m_segmentTokens;
+        quint32 m_lastSegment;
+
+        static QString userDir(const QString& userId);
+        bool ensureLoaded();
+        bool openFiles();
+        void flush();
+        QByteArray read(const IndexEntry& entry);
+        qint64 store(qint64 position, const QString& eventId, const QByteArray& json);
+        static quint32 idHash(const QString& eventId);
+        static quint32 segmentOf(qint64 position);
+};
+
+#endif // TIMELINESTORE_H
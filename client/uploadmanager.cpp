@@ -0,0 +1,470 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "uploadmanager.h"
+
+#include <QtCore/QRunnable>
+#include <QtCore/QBuffer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QSettings>
+#include <QtCore/QDateTime>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QDebug>
+#include <QtGui/QImageReader>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+#include "quaternionconnection.h"
+#include "quaternionroom.h"
+
+static const QSize ThumbnailBox { 800, 600 };
+// Limits for making a re-encoded image fit into max_image_kb
+static const int MinJpegQuality = 50;
+static const int MinDimension = 64;
+
+struct SizePolicy
+{
+    int maxDimension;
+    qint64 maxBytes;
+    int jpegQuality;
+
+    SizePolicy()
+    {
+        QSettings settings;
+        maxDimension = settings.value("Uploads/max_image_dimension", 2048).toInt();
+        maxBytes = settings.value("Uploads/max_image_kb", 1024).toLongLong() * 1024;
+        jpegQuality = settings.value("Uploads/jpeg_quality", 85).toInt();
+    }
+};
+
+class PrepareTask: public QRunnable
+{
+    public:
+        PrepareTask(UploadManager* manager, QString txnId, QString fileName, QByteArray data)
+            : m_manager(manager), m_txnId(txnId)
+            , m_fileName(fileName), m_data(data)
+        { }
+
+        void run() override
+        {
+            PreparedImage result = prepare();
+            QMetaObject::invokeMethod(m_manager, "prepared", Qt::QueuedConnection,
+                                      Q_ARG(QString, m_txnId),
+                                      Q_ARG(PreparedImage, result));
+        }
+
+    private:
+        UploadManager* m_manager;
+        QString m_txnId;
+        QString m_fileName;
+        QByteArray m_data; // Encoded image, when there's no file
+        SizePolicy m_policy;
+
+        PreparedImage prepare();
+        bool save(const QImage& image, int jpegQuality, PreparedImage& result,
+                  QString* fileName, QString* mimeType, qint64* fileSize);
+        bool saveData(PreparedImage& result);
+};
+
+PreparedImage PrepareTask::prepare()
+{
+    PreparedImage result;
+    result.fileSize = 0;
+    result.thumbnailFileSize = 0;
+
+    QBuffer buffer(&m_data);
+    QImageReader reader;
+    if (!m_fileName.isEmpty())
+        reader.setFileName(m_fileName);
+    else
+        reader.setDevice(&buffer);
+    QByteArray format = reader.format();
+    QSize size = reader.size();
+    qint64 fileSize = m_fileName.isEmpty() ? m_data.size() : QFileInfo(m_fileName).size();
+    bool withinLimits = size.isValid() &&
+            size.width() <= m_policy.maxDimension &&
+            size.height() <= m_policy.maxDimension &&
+            fileSize <= m_policy.maxBytes;
+    if (withinLimits && (format == "jpeg" || format == "png" || format == "gif"))
+    {
+        // Good as it is, no need to re-encode
+        if (!m_fileName.isEmpty())
+            result.fileName = m_fileName;
+        else if (!saveData(result))
+            return result;
+        result.mimeType = "image/" + QString(format);
+        result.size = size;
+        result.fileSize = fileSize;
+    }
+    else if (size.isValid() && (size.width() > m_policy.maxDimension ||
+                                size.height() > m_policy.maxDimension))
+    {
+        // Let the decoder do the downscaling if it can
+        size.scale(m_policy.maxDimension, m_policy.maxDimension, Qt::KeepAspectRatio);
+        reader.setScaledSize(size);
+    }
+    QImage image = reader.read();
+    if (image.isNull())
+    {
+        result.error = reader.errorString();
+        return result;
+    }
+    if (image.width() > m_policy.maxDimension || image.height() > m_policy.maxDimension)
+        image = image.scaled(m_policy.maxDimension, m_policy.maxDimension,
+                             Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    if (result.fileName.isEmpty())
+    {
+        // Re-encoding alone may not be enough; lower the JPEG quality
+        // first, then the dimensions, until the image fits
+        int quality = m_policy.jpegQuality;
+        for (;;)
+        {
+            result.size = image.size();
+            if (!save(image, quality, result, &result.fileName, &result.mimeType,
+                      &result.fileSize))
+                return result;
+            if (result.fileSize <= m_policy.maxBytes)
+                break;
+
+            QFile::remove(result.fileName);
+            result.temporaryFiles.removeOne(result.fileName);
+            result.fileName.clear();
+            if (result.mimeType == "image/jpeg" && quality > MinJpegQuality)
+                quality = qMax(MinJpegQuality, quality - 10);
+            else if (qMin(image.width(), image.height()) > MinDimension)
+                image = image.scaled(image.size() * 0.75, Qt::KeepAspectRatio,
+                                     Qt::SmoothTransformation);
+            else
+            {
+                result.error = QString("Couldn't make the image smaller than %1 KiB")
+                                   .arg(m_policy.maxBytes / 1024);
+                return result;
+            }
+        }
+    }
+
+    QImage thumbnail = image;
+    if (image.width() > ThumbnailBox.width() || image.height() > ThumbnailBox.height())
+        thumbnail = image.scaled(ThumbnailBox, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    result.thumbnailSize = thumbnail.size();
+    save(thumbnail, m_policy.jpegQuality, result, &result.thumbnailFile, &result.thumbnailMimeType,
+         &result.thumbnailFileSize);
+    return result;
+}
+
+bool PrepareTask::save(const QImage& image, int jpegQuality, PreparedImage& result,
+                       QString* fileName, QString* mimeType, qint64* fileSize)
+{
+    const bool lossless = image.hasAlphaChannel();
+    QTemporaryFile file;
+    file.setAutoRemove(false);
+    if (!file.open() ||
+        !image.save(&file, lossless ? "PNG" : "JPEG", lossless ? -1 : jpegQuality))
+    {
+        result.error = QString("Couldn't save the image to %1").arg(file.fileName());
+        file.remove();
+        return false;
+    }
+    *fileName = file.fileName();
+    *mimeType = lossless ? "image/png" : "image/jpeg";
+    *fileSize = file.size();
+    result.temporaryFiles.append(file.fileName());
+    return true;
+}
+
+bool PrepareTask::saveData(PreparedImage& result)
+{
+    QTemporaryFile file;
+    file.setAutoRemove(false);
+    if (!file.open() || file.write(m_data) != m_data.size())
+    {
+        result.error = QString("Couldn't save the image to %1").arg(file.fileName());
+        file.remove();
+        return false;
+    }
+    result.fileName = file.fileName();
+    result.temporaryFiles.append(file.fileName());
+    return true;
+}
+
+UploadManager::UploadManager(QuaternionConnection* connection, QObject* parent)
+    : QObject(parent)
+    , m_connection(connection)
+{
+    qRegisterMetaType<PreparedImage>();
+    m_pool.setMaxThreadCount(1);
+}
+
+UploadManager::~UploadManager()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+    for (const QString& txnId: m_uploads.keys())
+    {
+        QNetworkReply* reply = m_uploads.value(txnId).reply;
+        if (reply)
+        {
+            reply->disconnect(this);
+            reply->abort();
+            reply->deleteLater();
+        }
+        fail(txnId, "Upload cancelled");
+        cleanup(txnId);
+    }
+    for (const QString& fileName: m_previewFiles)
+        QFile::remove(fileName);
+}
+
+QString UploadManager::newTxnId()
+{
+    static int counter = 0;
+    return QString("q%1.%2").arg(QDateTime::currentMSecsSinceEpoch()).arg(++counter);
+}
+
+void UploadManager::uploadImage(QuaternionRoom* room, const QString& fileName)
+{
+    startPreparing(room, QFileInfo(fileName).fileName(), fileName, QByteArray());
+}
+
+void UploadManager::uploadImage(QuaternionRoom* room, const QByteArray& data)
+{
+    startPreparing(room, "image", QString(), data);
+}
+
+void UploadManager::startPreparing(QuaternionRoom* room, const QString& body,
+                                   const QString& fileName, const QByteArray& data)
+{
+    QString txnId = newTxnId();
+    Upload upload;
+    upload.room = room;
+    upload.body = body;
+    upload.sourceFile = fileName;
+    upload.data = data;
+    upload.reply = nullptr;
+    upload.bytesDone = 0;
+    upload.failed = false;
+    m_uploads.insert(txnId, upload);
+
+    connect( room, &QuaternionRoom::pendingEventRetryRequested,
+             this, &UploadManager::retry, Qt::UniqueConnection );
+    connect( room, &QuaternionRoom::pendingEventDiscardRequested,
+             this, &UploadManager::discard, Qt::UniqueConnection );
+    PendingEvent pending { txnId, "m.image", body, fileName,
+                           QDateTime::currentDateTimeUtc(), PendingEvent::Preparing, -1 };
+    room->addPendingEvent(pending);
+    m_pool.start(new PrepareTask(this, txnId, fileName, data));
+}
+
+void UploadManager::retry(const QString& txnId)
+{
+    auto it = m_uploads.find(txnId);
+    if (it == m_uploads.end() || !it->failed)
+        return;
+    Upload& upload = *it;
+    upload.failed = false;
+    // Continue from the step that failed
+    if (!upload.image.error.isEmpty() || upload.image.fileName.isEmpty())
+    {
+        for (const QString& fileName: upload.image.temporaryFiles)
+            QFile::remove(fileName);
+        upload.image = PreparedImage();
+        if (upload.room)
+            upload.room->updatePendingEvent(txnId, PendingEvent::Preparing);
+        m_pool.start(new PrepareTask(this, txnId, upload.sourceFile, upload.data));
+    }
+    else if (upload.contentUri.isEmpty())
+    {
+        upload.bytesDone = 0;
+        if (upload.room)
+            upload.room->updatePendingEvent(txnId, PendingEvent::Uploading, 0);
+        uploadFile(txnId, upload.image.fileName, upload.image.mimeType, false);
+    }
+    else if (upload.thumbnailUri.isEmpty())
+    {
+        if (upload.room)
+            upload.room->updatePendingEvent(txnId, PendingEvent::Uploading);
+        uploadFile(txnId, upload.image.thumbnailFile, upload.image.thumbnailMimeType, true);
+    }
+    else
+        sendEvent(txnId);
+}
+
+void UploadManager::discard(const QString& txnId)
+{
+    auto it = m_uploads.find(txnId);
+    if (it == m_uploads.end() || !it->failed)
+        return;
+    if (it->room)
+        it->room->removePendingEvent(txnId);
+    cleanup(txnId);
+}
+
+void UploadManager::prepared(const QString& txnId, const PreparedImage& image)
+{
+    if (!m_uploads.contains(txnId))
+        return;
+
+    Upload& upload = m_uploads[txnId];
+    upload.image = image;
+    if (!image.error.isEmpty())
+    {
+        fail(txnId, image.error);
+        return;
+    }
+    if (upload.room)
+    {
+        upload.room->setPendingLocalFile(txnId, image.thumbnailFile);
+        upload.room->updatePendingEvent(txnId, PendingEvent::Uploading, 0);
+    }
+    uploadFile(txnId, image.fileName, image.mimeType, false);
+}
+
+void UploadManager::uploadFile(const QString& txnId, const QString& fileName,
+                               const QString& mimeType, bool isThumbnail)
+{
+    QFile* file = new QFile(fileName);
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        delete file;
+        fail(txnId, QString("Couldn't read %1").arg(fileName));
+        return;
+    }
+
+    QUrlQuery query;
+    query.addQueryItem("filename", QFileInfo(fileName).fileName());
+    QNetworkRequest request = m_connection->makeRequest("/_matrix/media/r0/upload", query);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, mimeType);
+    request.setHeader(QNetworkRequest::ContentLengthHeader, file->size());
+
+    // The file is read and sent piecewise by QNetworkAccessManager
+    QNetworkReply* reply = m_connection->nam()->post(request, file);
+    file->setParent(reply);
+    m_uploads[txnId].reply = reply;
+
+    connect( reply, &QNetworkReply::uploadProgress, this, [=](qint64 sent, qint64) {
+        auto it = m_uploads.find(txnId);
+        if (it == m_uploads.end())
+            return;
+        const Upload& upload = *it;
+        const qint64 total = upload.image.fileSize + upload.image.thumbnailFileSize;
+        if (upload.room && total > 0)
+            upload.room->updatePendingEvent(txnId, PendingEvent::Uploading,
+                                            qreal(upload.bytesDone + sent) / total);
+    });
+    connect( reply, &QNetworkReply::finished, this, [=] {
+        reply->deleteLater();
+        Upload& upload = m_uploads[txnId];
+        upload.reply = nullptr;
+        QString uri = QJsonDocument::fromJson(reply->readAll())
+                        .object().value("content_uri").toString();
+        if (reply->error() != QNetworkReply::NoError || uri.isEmpty())
+        {
+            fail(txnId, reply->errorString());
+            return;
+        }
+        upload.bytesDone += file->size();
+        if (isThumbnail)
+        {
+            upload.thumbnailUri = uri;
+            sendEvent(txnId);
+        }
+        else
+        {
+            upload.contentUri = uri;
+            uploadFile(txnId, upload.image.thumbnailFile,
+                       upload.image.thumbnailMimeType, true);
+        }
+    });
+}
+
+void UploadManager::sendEvent(const QString& txnId)
+{
+    Upload& upload = m_uploads[txnId];
+    if (!upload.room)
+    {
+        cleanup(txnId);
+        return;
+    }
+    upload.room->updatePendingEvent(txnId, PendingEvent::Sending);
+
+    const PreparedImage& image = upload.image;
+    // QJsonObject has no initializer list constructor before Qt 5.4
+    QJsonObject thumbnailInfo;
+    thumbnailInfo.insert("w", image.thumbnailSize.width());
+    thumbnailInfo.insert("h", image.thumbnailSize.height());
+    thumbnailInfo.insert("mimetype", image.thumbnailMimeType);
+    thumbnailInfo.insert("size", double(image.thumbnailFileSize));
+    QJsonObject info;
+    info.insert("w", image.size.width());
+    info.insert("h", image.size.height());
+    info.insert("mimetype", image.mimeType);
+    info.insert("size", double(image.fileSize));
+    info.insert("thumbnail_url", upload.thumbnailUri);
+    info.insert("thumbnail_info", thumbnailInfo);
+    QJsonObject content;
+    content.insert("msgtype", QString("m.image"));
+    content.insert("body", upload.body);
+    content.insert("url", upload.contentUri);
+    content.insert("info", info);
+
+    QNetworkRequest request = m_connection->makeRequest(
+        QString("/_matrix/client/r0/rooms/%1/send/m.room.message/%2")
+            .arg(upload.room->id(), txnId));
+    QNetworkReply* reply = m_connection->nam()->put(request,
+                                QJsonDocument(content).toJson(QJsonDocument::Compact));
+    upload.reply = reply;
+    connect( reply, &QNetworkReply::finished, this, [=] {
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError)
+        {
+            fail(txnId, reply->errorString());
+            return;
+        }
+        Upload& upload = m_uploads[txnId];
+        // The pending event stays until the event comes back in a sync
+        if (upload.room)
+            upload.room->updatePendingEvent(txnId, PendingEvent::Sent, 1.0);
+        cleanup(txnId);
+    });
+}
+
+void UploadManager::fail(const QString& txnId, const QString& reason)
+{
+    qWarning() << "Upload" << txnId << "failed:" << reason;
+    // Everything done so far is kept until the user retries or discards it
+    Upload& upload = m_uploads[txnId];
+    upload.failed = true;
+    if (upload.room)
+        upload.room->updatePendingEvent(txnId, PendingEvent::Failed);
+}
+
+void UploadManager::cleanup(const QString& txnId)
+{
+    const PreparedImage& image = m_uploads[txnId].image;
+    for (const QString& fileName: image.temporaryFiles)
+        if (fileName == image.thumbnailFile)
+            m_previewFiles.append(fileName);
+        else
+            QFile::remove(fileName);
+    m_uploads.remove(txnId);
+}
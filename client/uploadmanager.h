@@ -0,0 +1,116 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef UPLOADMANAGER_H
+#define UPLOADMANAGER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QSize>
+#include <QtCore/QThreadPool>
+#include <QtCore/QPointer>
+#include <QtCore/QStringList>
+#include <QtGui/QImage>
+
+class QuaternionConnection;
+class QuaternionRoom;
+class QNetworkReply;
+
+/**
+ * An image ready for uploading, as produced by the preparation step
+ */
+struct PreparedImage
+{
+    QString fileName;
+    QString mimeType;
+    QSize size;
+    qint64 fileSize;
+    QString thumbnailFile;
+    QString thumbnailMimeType;
+    QSize thumbnailSize;
+    qint64 thumbnailFileSize;
+    QStringList temporaryFiles;
+    QString error;
+};
+Q_DECLARE_METATYPE(PreparedImage)
+
+/**
+ * Posts images to rooms.
+ *
+ * Decoding, downscaling and re-encoding happen on a worker thread according
+ * to the "Uploads/" settings: images larger than max_image_dimension
+ * (2048 by default) or max_image_kb (1024 by default) are scaled down and
+ * re-encoded as JPEG (or PNG if they have transparency); if that is still
+ * over max_image_kb, the JPEG quality and then the dimensions are lowered
+ * until it fits. A thumbnail is made along the way. The files are then streamed to the media repository and
+ * an m.image event with dimension metadata is sent. Meanwhile the room shows
+ * a pending event with the upload progress. A failed upload keeps what it
+ * has done so far; retrying it from the pending row continues from the
+ * step that failed.
+ */
+class UploadManager: public QObject
+{
+        Q_OBJECT
+    public:
+        UploadManager(QuaternionConnection* connection, QObject* parent = nullptr);
+        virtual ~UploadManager();
+
+        void uploadImage(QuaternionRoom* room, const QString& fileName);
+        /** Uploads an encoded image, such as a pasted one */
+        void uploadImage(QuaternionRoom* room, const QByteArray& data);
+
+        static QString newTxnId();
+
+    private slots:
+        void prepared(const QString& txnId, const PreparedImage& image);
+        void retry(const QString& txnId);
+        void discard(const QString& txnId);
+
+    private:
+        struct Upload
+        {
+            QPointer<QuaternionRoom> room;
+            QString body;
+            QString sourceFile; // Or the encoded image in data
+            QByteArray data;
+            PreparedImage image;
+            QString contentUri;
+            QString thumbnailUri;
+            QNetworkReply* reply;
+            qint64 bytesDone;
+            bool failed; // Waits for the user to retry or discard it
+        };
+
+        QuaternionConnection* m_connection;
+        QHash<QString, Upload> m_uploads;
+        QThreadPool m_pool;
+
+        void startPreparing(QuaternionRoom* room, const QString& body,
+                            const QString& fileName, const QByteArray& data);
+        void uploadFile(const QString& txnId, const QString& fileName,
+                        const QString& mimeType, bool isThumbnail);
+        void sendEvent(const QString& txnId);
+        void fail(const QString& txnId, const QString& reason);
+        void cleanup(const QString& txnId);
+
+        /** Thumbnails still shown by pending events; removed on destruction */
+        QStringList m_previewFiles;
+};
+
+#endif // UPLOADMANAGER_H
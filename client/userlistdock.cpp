@@ -21,10 +21,13 @@
 
 #include <QtWidgets/QTableView>
 #include <QtWidgets/QHeaderView>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QVBoxLayout>
 
 #include "lib/connection.h"
 #include "lib/room.h"
 #include "models/userlistmodel.h"
+#include "quaternionroom.h"
 
 UserListDock::UserListDock(QWidget* parent)
     : QDockWidget("Users", parent)
@@ -35,10 +38,23 @@ UserListDock::UserListDock(QWidget* parent)
     m_view->horizontalHeader()->setStretchLastSection(true);
     m_view->horizontalHeader()->setVisible(false);
     m_view->verticalHeader()->setVisible(false);
-    setWidget(m_view);
+
+    m_filterEdit = new QLineEdit();
+    m_filterEdit->setPlaceholderText(tr("Search members"));
+    m_filterEdit->setClearButtonEnabled(true);
+
+    QWidget* container = new QWidget();
+    QVBoxLayout* layout = new QVBoxLayout();
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(m_filterEdit);
+    layout->addWidget(m_view);
+    container->setLayout(layout);
+    setWidget(container);
 
     m_model = new UserListModel();
     m_view->setModel(m_model);
+    connect( m_filterEdit, &QLineEdit::textChanged, m_model, &UserListModel::setFilter );
+    connect( m_model, &UserListModel::memberCountChanged, this, &UserListDock::updateTitle );
 }
 
 UserListDock::~UserListDock()
@@ -50,7 +66,18 @@ void UserListDock::setConnection(QMatrixClient::Connection* connection)
     m_model->setConnection(connection);
 }
 
-void UserListDock::setRoom(QMatrixClient::Room* room)
+void UserListDock::setRoom(QuaternionRoom* room)
 {
+    // Syncs are lazy-loading members, so get the rest on the first visit
+    if( room )
+        room->loadMembers();
     m_model->setRoom(room);
 }
+
+void UserListDock::updateTitle(int memberCount)
+{
+    if( memberCount > 0 )
+        setWindowTitle(tr("Users (%1)").arg(memberCount));
+    else
+        setWindowTitle(tr("Users"));
+}
@@ -29,7 +29,9 @@ namespace QMatrixClient
 }
 
 class UserListModel;
+class QuaternionRoom;
 class QTableView;
+class QLineEdit;
 
 class UserListDock: public QDockWidget
 {
@@ -39,10 +41,14 @@ class UserListDock: public QDockWidget
         virtual ~UserListDock();
 
         void setConnection( QMatrixClient::Connection* connection );
-        void setRoom( QMatrixClient::Room* room );
+        void setRoom( QuaternionRoom* room );
+
+    private slots:
+        void updateTitle( int memberCount );
 
     private:
         QTableView* m_view;
+        QLineEdit* m_filterEdit;
         UserListModel* m_model;
 };
 
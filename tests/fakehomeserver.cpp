@@ -0,0 +1,115 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "fakehomeserver.h"
+
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QTcpSocket>
+
+FakeHomeserver::FakeHomeserver(QObject* parent)
+    : QObject(parent)
+    , m_bytesSent(0)
+{
+    connect( &m_server, &QTcpServer::newConnection, this, &FakeHomeserver::newConnection );
+}
+
+bool FakeHomeserver::listen()
+{
+    return m_server.listen(QHostAddress::LocalHost);
+}
+
+QUrl FakeHomeserver::url() const
+{
+    return QUrl(QString("http://127.0.0.1:%1").arg(m_server.serverPort()));
+}
+
+void FakeHomeserver::setHandler(const Handler& handler)
+{
+    m_handler = handler;
+}
+
+QList<FakeHomeserver::Request> FakeHomeserver::requests() const
+{
+    return m_requests;
+}
+
+qint64 FakeHomeserver::bytesSent() const
+{
+    return m_bytesSent;
+}
+
+void FakeHomeserver::reset()
+{
+    m_requests.clear();
+    m_bytesSent = 0;
+}
+
+void FakeHomeserver::newConnection()
+{
+    while (QTcpSocket* socket = m_server.nextPendingConnection())
+    {
+        connect( socket, &QTcpSocket::readyRead, this, &FakeHomeserver::readRequest );
+        connect( socket, &QTcpSocket::disconnected, this, [=] {
+            m_buffers.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void FakeHomeserver::readRequest()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket)
+        return;
+    QByteArray& buffer = m_buffers[socket];
+    buffer += socket->readAll();
+
+    const int headerEnd = buffer.indexOf("\r\n\r\n");
+    if (headerEnd == -1)
+        return;
+    const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+    qint64 contentLength = 0;
+    for (const QByteArray& line: lines.mid(1))
+    {
+        const int colon = line.indexOf(':');
+        if (colon != -1 && line.left(colon).trimmed().toLower() == "content-length")
+            contentLength = line.mid(colon + 1).trimmed().toLongLong();
+    }
+    if (buffer.size() < headerEnd + 4 + contentLength)
+        return; // The body isn't complete yet
+
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    Request request;
+    request.method = requestLine.value(0);
+    request.url = url().resolved(QUrl::fromEncoded(requestLine.value(1)));
+    request.body = buffer.mid(headerEnd + 4, int(contentLength));
+    m_buffers.remove(socket);
+    m_requests.append(request);
+
+    const QByteArray body = m_handler ? m_handler(request) : QByteArray();
+    QByteArray response = body.isNull() ? "HTTP/1.1 404 Not Found\r\n"
+                                        : "HTTP/1.1 200 OK\r\n";
+    response += "Content-Type: application/json\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+    m_bytesSent += response.size();
+    socket->write(response);
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,76 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#ifndef FAKEHOMESERVER_H
+#define FAKEHOMESERVER_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QUrl>
+#include <QtNetwork/QTcpServer>
+
+#include <functional>
+
+class QTcpSocket;
+
+/**
+ * A minimal HTTP server on localhost for tests and benchmarks that talk to
+ * a homeserver. Every request is passed to the handler, which returns the
+ * JSON body of the response; a null QByteArray makes it a 404. Connections
+ * are closed after each response.
+ */
+class FakeHomeserver: public QObject
+{
+        Q_OBJECT
+    public:
+        struct Request
+        {
+            QByteArray method;
+            QUrl url;
+            QByteArray body;
+        };
+        using Handler = std::function<QByteArray(const Request&)>;
+
+        explicit FakeHomeserver(QObject* parent = nullptr);
+
+        bool listen();
+        QUrl url() const;
+        void setHandler(const Handler& handler);
+
+        /** Requests served so far, oldest first */
+        QList<Request> requests() const;
+        /** Response bytes sent so far, headers included */
+        qint64 bytesSent() const;
+        void reset();
+
+    private slots:
+        void newConnection();
+        void readRequest();
+
+    private:
+        QTcpServer m_server;
+        Handler m_handler;
+        QHash<QTcpSocket*, QByteArray> m_buffers;
+        QList<Request> m_requests;
+        qint64 m_bytesSent;
+};
+
+#endif // FAKEHOMESERVER_H
@@ -0,0 +1,187 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "fakehomeserver.h"
+#include "quaternionconnection.h"
+#include "models/publicroomsmodel.h"
+
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
+#include <QtTest/QtTest>
+
+static const int RoomCount = 45;
+static const int PageSize = 10;
+
+class PublicRoomsModelTest: public QObject
+{
+        Q_OBJECT
+    private slots:
+        void initTestCase();
+        void init();
+        void cleanup();
+        void loadsPagesInOrder();
+        void reloadsEvictedPagesLater();
+        void sendsSearchTerm();
+
+    private:
+        FakeHomeserver* m_server;
+        QuaternionConnection* m_connection;
+
+        static QByteArray publicRooms(const FakeHomeserver::Request& request);
+        void loadAll(PublicRoomsModel& model, const QString& searchTerm);
+};
+
+void PublicRoomsModelTest::initTestCase()
+{
+    // Keeps the real settings of the user untouched
+    QStandardPaths::setTestModeEnabled(true);
+    QCoreApplication::setOrganizationName("QMatrixClient");
+    QCoreApplication::setApplicationName("quaternion-tests");
+    QSettings settings;
+    settings.setValue("Directory/page_size", PageSize);
+    settings.setValue("Directory/cached_pages", 2);
+}
+
+void PublicRoomsModelTest::init()
+{
+    m_server = new FakeHomeserver(this);
+    m_server->setHandler(&PublicRoomsModelTest::publicRooms);
+    QVERIFY(m_server->listen());
+    m_connection = new QuaternionConnection(m_server->url(), this);
+}
+
+void PublicRoomsModelTest::cleanup()
+{
+    delete m_connection;
+    delete m_server;
+}
+
+QByteArray PublicRoomsModelTest::publicRooms(const FakeHomeserver::Request& request)
+{
+    if (request.url.path() != "/_matrix/client/r0/publicRooms")
+        return QByteArray();
+
+    // "since" tokens are plain offsets; a search narrows the list to the
+    // rooms whose number contains the search term
+    const QJsonObject body = QJsonDocument::fromJson(request.body).object();
+    const int since = body.value("since").toString().toInt();
+    const int limit = body.value("limit").toInt();
+    const QString term =
+        body.value("filter").toObject().value("generic_search_term").toString();
+    QList<int> rooms;
+    for (int i = 0; i < RoomCount; ++i)
+        if (term.isEmpty() || QString::number(i).contains(term))
+            rooms << i;
+
+    QJsonArray chunk;
+    for (int i = since; i < qMin(since + limit, rooms.size()); ++i)
+    {
+        QJsonObject room;
+        room.insert("room_id", QString("!room%1:example.org").arg(rooms.at(i)));
+        room.insert("name", QString("Room %1").arg(rooms.at(i)));
+        room.insert("num_joined_members", rooms.at(i));
+        chunk.append(room);
+    }
+    QJsonObject response;
+    response.insert("chunk", chunk);
+    response.insert("total_room_count_estimate", rooms.size());
+    if (since + limit < rooms.size())
+        response.insert("next_batch", QString::number(since + limit));
+    return QJsonDocument(response).toJson(QJsonDocument::Compact);
+}
+
+void PublicRoomsModelTest::loadAll(PublicRoomsModel& model, const QString& searchTerm)
+{
+    bool loading = false;
+    auto c = connect( &model, &PublicRoomsModel::loadingChanged,
+                      [&loading](bool l) { loading = l; } );
+    model.setSearchTerm(searchTerm);
+    QTRY_VERIFY(!loading);
+    while (model.canFetchMore(QModelIndex()))
+    {
+        model.fetchMore(QModelIndex());
+        QTRY_VERIFY(!loading);
+    }
+    disconnect(c);
+}
+
+void PublicRoomsModelTest::loadsPagesInOrder()
+{
+    PublicRoomsModel model(m_connection);
+    QSignalSpy estimates(&model, SIGNAL(totalEstimateChanged(int)));
+    loadAll(model, QString());
+
+    QCOMPARE(model.rowCount(), RoomCount);
+    QCOMPARE(model.totalEstimate(), RoomCount);
+    QVERIFY(!estimates.isEmpty());
+    // Only two pages stay cached; the others come again when asked for
+    for (int row = 0; row < RoomCount; row += 7)
+        QTRY_COMPARE(model.data(model.index(row), PublicRoomsModel::RoomIdRole).toString(),
+                     QString("!room%1:example.org").arg(row));
+    // One request per page while loading, each continuing from the
+    // previous one
+    const QList<FakeHomeserver::Request> requests =
+        m_server->requests().mid(0, (RoomCount + PageSize - 1) / PageSize);
+    QCOMPARE(requests.size(), (RoomCount + PageSize - 1) / PageSize);
+    for (int i = 0; i < requests.size(); ++i)
+    {
+        const QJsonObject body = QJsonDocument::fromJson(requests.at(i).body).object();
+        QCOMPARE(body.value("since").toString(), i == 0 ? QString() : QString::number(i * PageSize));
+        QCOMPARE(body.value("limit").toInt(), PageSize);
+    }
+}
+
+void PublicRoomsModelTest::reloadsEvictedPagesLater()
+{
+    PublicRoomsModel model(m_connection);
+    loadAll(model, QString());
+    m_server->reset();
+
+    // Only the last two pages are kept; the first one has to come again,
+    // but not from within data()
+    const QModelIndex first = model.index(0);
+    QCOMPARE(model.data(first, PublicRoomsModel::RoomIdRole), QVariant());
+    QVERIFY(!model.data(first).toString().isEmpty());
+    QCOMPARE(m_server->requests().size(), 0);
+
+    QSignalSpy changed(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)));
+    QTRY_COMPARE(model.data(first, PublicRoomsModel::RoomIdRole).toString(),
+                 QString("!room0:example.org"));
+    QCOMPARE(m_server->requests().size(), 1);
+    QCOMPARE(model.rowCount(), RoomCount);
+    QVERIFY(!changed.isEmpty());
+}
+
+void PublicRoomsModelTest::sendsSearchTerm()
+{
+    PublicRoomsModel model(m_connection);
+    loadAll(model, "  4 ");
+
+    // 4, 14, 24, 34, 40-44
+    QCOMPARE(model.rowCount(), 9);
+    const QJsonObject body = QJsonDocument::fromJson(m_server->requests().first().body).object();
+    QCOMPARE(body.value("filter").toObject().value("generic_search_term").toString(),
+             QString("4"));
+}
+
+QTEST_GUILESS_MAIN(PublicRoomsModelTest)
+#include "publicroomsmodeltest.moc"
@@ -0,0 +1,183 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "statecache.h"
+#include "quaternionconnection.h"
+#include "models/roomlistmodel.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonObject>
+#include <QtCore/QStandardPaths>
+#include <QtTest/QtTest>
+
+class StateCacheBenchmark: public QObject
+{
+        Q_OBJECT
+    private slots:
+        void initTestCase();
+        void cleanupTestCase();
+        void restore_data();
+        void restore();
+        void loadState_data();
+        void loadState();
+
+    private:
+        static QJsonObject event(const QString& type, const QString& stateKey,
+                                 const QString& sender, int n);
+        static QJsonObject syncResponse(int rooms);
+};
+
+static const QString UserId = "@bench:example.org";
+
+void StateCacheBenchmark::initTestCase()
+{
+    // Keeps the real cache of the user untouched
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void StateCacheBenchmark::cleanupTestCase()
+{
+    StateCache(UserId).clear();
+    // The connection in loadState() isn't logged in, so its cache is this one
+    StateCache(QString()).clear();
+}
+
+QJsonObject StateCacheBenchmark::event(const QString& type, const QString& stateKey,
+                                       const QString& sender, int n)
+{
+    QJsonObject content;
+    if (type == "m.room.member")
+    {
+        content.insert("membership", QString("join"));
+        content.insert("displayname", sender.mid(1, sender.indexOf(':') - 1));
+    }
+    else
+    {
+        content.insert("msgtype", QString("m.text"));
+        content.insert("body", QString("Message number %1, long enough to look "
+                                       "like an ordinary line of chat").arg(n));
+    }
+    QJsonObject e;
+    e.insert("type", type);
+    e.insert("event_id", QString("$%1:example.org").arg(qrand()));
+    e.insert("sender", sender);
+    e.insert("origin_server_ts", 1500000000000.0 + n);
+    e.insert("content", content);
+    if (!stateKey.isNull())
+        e.insert("state_key", stateKey);
+    return e;
+}
+
+QJsonObject StateCacheBenchmark::syncResponse(int rooms)
+{
+    QJsonObject joined;
+    for (int r = 0; r < rooms; ++r)
+    {
+        QJsonArray stateEvents;
+        QStringList members;
+        for (int m = 0; m < 20; ++m)
+        {
+            members << QString("@user%1_%2:example.org").arg(r).arg(m);
+            stateEvents.append(event("m.room.member", members.last(), members.last(), m));
+        }
+        QJsonObject nameContent;
+        nameContent.insert("name", QString("Room %1").arg(r));
+        QJsonObject name = event("m.room.name", "", members.first(), 0);
+        name.insert("content", nameContent);
+        stateEvents.append(name);
+
+        QJsonArray timelineEvents;
+        for (int i = 0; i < 30; ++i)
+            timelineEvents.append(event("m.room.message", QString(),
+                                        members.at(i % members.size()), i));
+
+        QJsonObject state;
+        state.insert("events", stateEvents);
+        QJsonObject timeline;
+        timeline.insert("events", timelineEvents);
+        timeline.insert("prev_batch", QString("p%1").arg(r));
+        QJsonObject room;
+        room.insert("state", state);
+        room.insert("timeline", timeline);
+        joined.insert(QString("!room%1:example.org").arg(r), room);
+    }
+    QJsonObject roomsJson;
+    roomsJson.insert("join", joined);
+    QJsonObject response;
+    response.insert("next_batch", QString("s1"));
+    response.insert("rooms", roomsJson);
+    return response;
+}
+
+void StateCacheBenchmark::restore_data()
+{
+    QTest::addColumn<int>("rooms");
+    QTest::newRow("100 rooms") << 100;
+    QTest::newRow("500 rooms") << 500;
+    QTest::newRow("1000 rooms") << 1000;
+}
+
+void StateCacheBenchmark::restore()
+{
+    QFETCH(int, rooms);
+    {
+        StateCache cache(UserId);
+        cache.update(syncResponse(rooms));
+        QVERIFY(cache.save());
+    }
+    QJsonObject restored;
+    QBENCHMARK {
+        StateCache cache(UserId);
+        restored = cache.load();
+    }
+    QCOMPARE(restored.value("rooms").toObject().value("join").toObject().size(), rooms);
+}
+
+void StateCacheBenchmark::loadState_data()
+{
+    restore_data();
+}
+
+void StateCacheBenchmark::loadState()
+{
+    QFETCH(int, rooms);
+    QuaternionConnection connection(QUrl("https://example.org"));
+    {
+        StateCache cache(connection.userId());
+        cache.update(syncResponse(rooms));
+        QVERIFY(cache.save());
+    }
+    RoomListModel model;
+    model.setConnection(&connection);
+
+    // What the user waits for on startup: from reading the cache to
+    // having every room in the list
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(connection.loadState());
+    while (model.rowCount() < rooms && timer.elapsed() < 60000)
+        QCoreApplication::processEvents();
+    const qint64 elapsed = timer.elapsed();
+    QCOMPARE(model.rowCount(), rooms);
+    QTest::setBenchmarkResult(elapsed, QTest::WalltimeMilliseconds);
+}
+
+QTEST_GUILESS_MAIN(StateCacheBenchmark)
+#include "statecachebenchmark.moc"
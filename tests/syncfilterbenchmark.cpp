@@ -0,0 +1,320 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2016 Felix Rohrbach <kde@fxrh.de>                        *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "fakehomeserver.h"
+#include "quaternionconnection.h"
+
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSet>
+#include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QUrlQuery>
+#include <QtTest/QtTest>
+
+static const int RoomCount = 200;
+static const int MemberCount = 50;
+static const int TimelineSize = 50;
+
+/**
+ * Compares the initial sync with and without the client's sync filter.
+ * The fake server applies the filter the way a homeserver would, so the
+ * difference in response size and in the time until syncDone() is what
+ * the filter saves on a real account.
+ */
+class SyncFilterBenchmark: public QObject
+{
+        Q_OBJECT
+    private slots:
+        void initTestCase();
+        void cleanupTestCase();
+        void initialSync_data();
+        void initialSync();
+        void filterMakesSyncSmaller();
+
+    private:
+        FakeHomeserver m_server;
+        QJsonObject m_fullSync;
+        bool m_acceptFilters;
+        QHash<QString, QJsonObject> m_filters;
+        QHash<QString, qint64> m_syncBytes;
+
+        QByteArray handle(const FakeHomeserver::Request& request);
+        qint64 runInitialSync();
+        static QJsonObject makeSync();
+        static QJsonObject applyFilter(const QJsonObject& sync, const QJsonObject& filter);
+};
+
+static QJsonObject event(const QString& type, const QString& sender, int n,
+                         const QString& stateKey = QString())
+{
+    QJsonObject content;
+    content.insert("body", QString("Event %1 of type %2, with some text in it").arg(n).arg(type));
+    QJsonObject e;
+    e.insert("type", type);
+    e.insert("event_id", QString("$%1_%2:example.org").arg(type).arg(n));
+    e.insert("sender", sender);
+    e.insert("origin_server_ts", 1500000000000.0 + n);
+    e.insert("content", content);
+    if (!stateKey.isNull())
+        e.insert("state_key", stateKey);
+    return e;
+}
+
+static QJsonObject eventList(const QJsonArray& events)
+{
+    QJsonObject list;
+    list.insert("events", events);
+    return list;
+}
+
+QJsonObject SyncFilterBenchmark::makeSync()
+{
+    // Rooms full of state and events the client has no use for, the way
+    // long-lived rooms on big servers look
+    QStringList stateTypes;
+    stateTypes << "m.room.create" << "m.room.power_levels" << "m.room.join_rules"
+               << "m.room.history_visibility" << "m.room.guest_access"
+               << "m.room.name" << "m.room.topic" << "m.room.avatar"
+               << "m.room.canonical_alias" << "im.vector.modular.widgets";
+    QStringList timelineTypes;
+    timelineTypes << "m.room.message" << "m.room.message" << "m.room.message"
+                  << "m.reaction" << "m.room.redaction" << "m.call.invite"
+                  << "m.room.member";
+
+    QJsonObject joined;
+    for (int r = 0; r < RoomCount; ++r)
+    {
+        QJsonArray state;
+        for (int m = 0; m < MemberCount; ++m)
+        {
+            const QString user = QString("@user%1:example.org").arg(m);
+            state.append(event("m.room.member", user, m, user));
+        }
+        for (const QString& type: stateTypes)
+            state.append(event(type, "@user0:example.org", r, ""));
+
+        QJsonArray timeline;
+        for (int i = 0; i < TimelineSize; ++i)
+        {
+            const QString type = timelineTypes.at(i % timelineTypes.size());
+            const QString sender = QString("@user%1:example.org").arg(i % 5);
+            timeline.append(type == "m.room.member" ? event(type, sender, i, sender)
+                                                    : event(type, sender, r * 1000 + i));
+        }
+
+        QJsonObject timelineJson = eventList(timeline);
+        timelineJson.insert("limited", true);
+        timelineJson.insert("prev_batch", QString("p%1").arg(r));
+        QJsonArray ephemeral;
+        ephemeral.append(event("m.typing", "", r));
+        ephemeral.append(event("m.receipt", "", r));
+        QJsonArray accountData;
+        accountData.append(event("m.fully_read", "", r));
+        accountData.append(event("m.tag", "", r));
+        accountData.append(event("org.example.client.settings", "", r));
+
+        QJsonObject room;
+        room.insert("state", eventList(state));
+        room.insert("timeline", timelineJson);
+        room.insert("ephemeral", eventList(ephemeral));
+        room.insert("account_data", eventList(accountData));
+        joined.insert(QString("!room%1:example.org").arg(r), room);
+    }
+    QJsonArray presence;
+    for (int m = 0; m < MemberCount * 4; ++m)
+        presence.append(event("m.presence", QString("@user%1:example.org").arg(m), m));
+    QJsonArray accountData;
+    for (int i = 0; i < 20; ++i)
+        accountData.append(event(QString("org.example.setting%1").arg(i), "", i));
+
+    QJsonObject rooms;
+    rooms.insert("join", joined);
+    QJsonObject sync;
+    sync.insert("next_batch", QString("s1"));
+    sync.insert("rooms", rooms);
+    sync.insert("presence", eventList(presence));
+    sync.insert("account_data", eventList(accountData));
+    return sync;
+}
+
+static bool typeAllowed(const QString& type, const QJsonObject& filter)
+{
+    if (filter.contains("types") && !filter.value("types").toArray().contains(type))
+        return false;
+    for (const QJsonValue& v: filter.value("not_types").toArray())
+        if (v.toString() == "*" || v.toString() == type)
+            return false;
+    return true;
+}
+
+static QJsonObject filterEvents(const QJsonObject& list, const QJsonObject& filter,
+                                int limit = -1)
+{
+    QJsonArray kept;
+    const QJsonArray events = list.value("events").toArray();
+    for (const QJsonValue& v: events)
+        if (typeAllowed(v.toObject().value("type").toString(), filter))
+            kept.append(v);
+    // The timeline limit keeps the newest events
+    while (limit >= 0 && kept.size() > limit)
+        kept.removeFirst();
+    QJsonObject result = list;
+    result.insert("events", kept);
+    return result;
+}
+
+QJsonObject SyncFilterBenchmark::applyFilter(const QJsonObject& sync, const QJsonObject& filter)
+{
+    const QJsonObject roomFilter = filter.value("room").toObject();
+    const QJsonObject stateFilter = roomFilter.value("state").toObject();
+    const QJsonObject timelineFilter = roomFilter.value("timeline").toObject();
+    const int limit = timelineFilter.contains("limit")
+                      ? timelineFilter.value("limit").toInt() : -1;
+
+    QJsonObject joined = sync.value("rooms").toObject().value("join").toObject();
+    for (auto it = joined.begin(); it != joined.end(); ++it)
+    {
+        QJsonObject room = it.value().toObject();
+        const QJsonObject timeline =
+            filterEvents(room.value("timeline").toObject(), timelineFilter, limit);
+        QJsonObject state = filterEvents(room.value("state").toObject(), stateFilter);
+        if (stateFilter.value("lazy_load_members").toBool())
+        {
+            // Only the members that sent something in the timeline
+            QSet<QString> senders;
+            for (const QJsonValue& v: timeline.value("events").toArray())
+                senders.insert(v.toObject().value("sender").toString());
+            QJsonArray events;
+            for (const QJsonValue& v: state.value("events").toArray())
+            {
+                const QJsonObject e = v.toObject();
+                if (e.value("type").toString() != "m.room.member" ||
+                        senders.contains(e.value("state_key").toString()))
+                    events.append(e);
+            }
+            state.insert("events", events);
+        }
+        room.insert("state", state);
+        room.insert("timeline", timeline);
+        room.insert("ephemeral", filterEvents(room.value("ephemeral").toObject(),
+                                              roomFilter.value("ephemeral").toObject()));
+        room.insert("account_data", filterEvents(room.value("account_data").toObject(),
+                                                 roomFilter.value("account_data").toObject()));
+        it.value() = room;
+    }
+    QJsonObject rooms;
+    rooms.insert("join", joined);
+    QJsonObject result = sync;
+    result.insert("rooms", rooms);
+    result.insert("presence", filterEvents(sync.value("presence").toObject(),
+                                           filter.value("presence").toObject()));
+    result.insert("account_data", filterEvents(sync.value("account_data").toObject(),
+                                               filter.value("account_data").toObject()));
+    return result;
+}
+
+QByteArray SyncFilterBenchmark::handle(const FakeHomeserver::Request& request)
+{
+    const QString path = request.url.path();
+    if (path.endsWith("/filter") && request.method == "POST")
+    {
+        if (!m_acceptFilters)
+            return QByteArray(); // The client falls back to unfiltered syncs
+        const QString id = QString::number(m_filters.size() + 1);
+        m_filters.insert(id, QJsonDocument::fromJson(request.body).object());
+        QJsonObject response;
+        response.insert("filter_id", id);
+        return QJsonDocument(response).toJson(QJsonDocument::Compact);
+    }
+    if (path == "/_matrix/client/r0/sync")
+    {
+        const QString filter = QUrlQuery(request.url).queryItemValue("filter",
+                                                                     QUrl::FullyDecoded);
+        QJsonObject sync = m_fullSync;
+        if (filter.startsWith('{'))
+            sync = applyFilter(sync, QJsonDocument::fromJson(filter.toUtf8()).object());
+        else if (!filter.isEmpty())
+            sync = applyFilter(sync, m_filters.value(filter));
+        return QJsonDocument(sync).toJson(QJsonDocument::Compact);
+    }
+    return QByteArray();
+}
+
+void SyncFilterBenchmark::initTestCase()
+{
+    m_acceptFilters = false;
+    QStandardPaths::setTestModeEnabled(true);
+    QCoreApplication::setOrganizationName("QMatrixClient");
+    QCoreApplication::setApplicationName("quaternion-tests");
+    m_fullSync = makeSync();
+    m_server.setHandler([this](const FakeHomeserver::Request& r) { return handle(r); });
+    QVERIFY(m_server.listen());
+}
+
+void SyncFilterBenchmark::cleanupTestCase()
+{
+    QSettings().remove("Sync/filters");
+}
+
+qint64 SyncFilterBenchmark::runInitialSync()
+{
+    // Filter ids are remembered per server; every run registers anew
+    QSettings().remove("Sync/filters");
+    m_server.reset();
+    QuaternionConnection connection(m_server.url());
+    QSignalSpy done(&connection, SIGNAL(syncDone()));
+    QSignalSpy failed(&connection, SIGNAL(syncFailed(int,QString,int,QString)));
+    connection.sync(0, false);
+    if (!done.wait(60000) || !failed.isEmpty())
+        return -1;
+    // The filter registration is part of the cost of filtering
+    return m_server.bytesSent();
+}
+
+void SyncFilterBenchmark::initialSync_data()
+{
+    QTest::addColumn<bool>("filtered");
+    QTest::newRow("unfiltered") << false;
+    QTest::newRow("filtered") << true;
+}
+
+void SyncFilterBenchmark::initialSync()
+{
+    QFETCH(bool, filtered);
+    m_acceptFilters = filtered;
+    qint64 bytes = 0;
+    QBENCHMARK {
+        bytes = runInitialSync();
+    }
+    QVERIFY(bytes > 0);
+    m_syncBytes.insert(QTest::currentDataTag(), bytes);
+    qDebug() << QTest::currentDataTag() << "initial sync:" << bytes / 1024 << "KiB";
+}
+
+void SyncFilterBenchmark::filterMakesSyncSmaller()
+{
+    if (m_syncBytes.size() < 2)
+        QSKIP("initialSync didn't run for both cases");
+    QVERIFY(m_syncBytes.value("filtered") * 2 < m_syncBytes.value("unfiltered"));
+}
+
+QTEST_GUILESS_MAIN(SyncFilterBenchmark)
+#include "syncfilterbenchmark.moc"